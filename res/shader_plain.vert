@@ -6,12 +6,19 @@ layout (location = 2) in vec3 norm;
 out float light_pass;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
+// Set once per frame; see CameraBlock in main.c.
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 proj;
+};
+// Positions may be quantized; see mesh_pack_vertices.
+uniform vec3 pos_scale;
+uniform vec3 pos_offset;
 
 void main() {
     vec3 light_vec = normalize(vec3(6, -3, 9));
     vec3 gnorm = normalize(mat3(model) * norm);
     light_pass = atan(dot(gnorm, light_vec)/length(gnorm)*3) * 0.4 + 0.5;
-    gl_Position = proj * view * model * vec4(pos, 1);
+    vec3 p = pos_offset + pos_scale * pos;
+    gl_Position = proj * view * model * vec4(p, 1);
 }
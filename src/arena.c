@@ -0,0 +1,41 @@
+#include "arena.h"
+#include <stdlib.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size_t align = sizeof (max_align_t);
+    size = (size + align - 1) / align * align;
+    ArenaBlock* b = arena->blocks;
+    if (!b || b->size - b->used < size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = malloc(sizeof *b + block_size);
+        if (!b) {
+            return NULL;
+        }
+        b->size = block_size;
+        b->used = 0;
+        b->next = arena->blocks;
+        arena->blocks = b;
+    }
+    void* p = (char*)b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+void arena_free(Arena* arena) {
+    ArenaBlock* b = arena->blocks;
+    while (b) {
+        ArenaBlock* next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->blocks = NULL;
+}
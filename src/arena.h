@@ -0,0 +1,19 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+// Bump allocator for short-lived scratch memory. Everything allocated from
+// an arena is released together by arena_free. A zero-initialized Arena is
+// empty and ready to use.
+typedef struct {
+    ArenaBlock* blocks;
+} Arena;
+
+// Returns size bytes aligned for any type, or NULL if out of memory.
+void* arena_alloc(Arena* arena, size_t size);
+void arena_free(Arena* arena);
+
+#endif // ARENA_H
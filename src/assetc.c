@@ -0,0 +1,266 @@
+// Asset cooker: converts files from res/ into the formats the game loads
+// fastest. OBJ meshes become indexed .mesh files, BMP images become .tex
+// files with a full mipmap chain, and shaders and MTL material libraries
+// are checked and copied.
+// Meshes are reordered for the vertex cache, split into clusters for
+// culling and given simplified levels of detail.
+//
+// Usage: assetc [-f] [-j threads] out_dir input...
+//
+// Inputs are cooked in parallel. An input whose output is newer than it is
+// skipped unless -f is given.
+
+#include "arena.h"
+#include "file.h"
+#include "image.h"
+#include "mesh.h"
+#include "meshopt.h"
+#include "obj.h"
+#include "pool.h"
+#include "simplify.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool (*CookFn)(const char* src, const char* dst);
+
+typedef struct {
+    const char* src;
+    char dst[512];
+    CookFn cook;
+    bool ok;
+} Task;
+
+static bool cook_mesh(const char* src, const char* dst) {
+    Arena arena = {0};
+    Mesh mesh;
+    float acmr_before, acmr_after;
+    bool ok = read_obj_file(&arena, NULL, src, &mesh) &&
+              optimize_mesh(&arena, &mesh, &acmr_before, &acmr_after) &&
+              build_lods(&arena, &mesh) &&
+              write_mesh_file(dst, src, &mesh);
+    if (ok) {
+        printf("%s: %zu submeshes, %zu clusters, ACMR %.3f -> %.3f, "
+               "triangles", src, mesh.n_submeshes, mesh.n_clusters,
+               acmr_before, acmr_after);
+        for (int i = 0; i < mesh.n_lods; i++) {
+            printf(" %u (error %g)", mesh.lods[i].n_indices / 3,
+                   mesh.lods[i].error);
+        }
+        printf("\n");
+    }
+    arena_free(&arena);
+    return ok;
+}
+
+static bool cook_texture(const char* src, const char* dst) {
+    Arena arena = {0};
+    Image image;
+    bool ok = read_bmp_file(&arena, src, &image);
+    if (!ok) {
+        fprintf(stderr, "%s: not an uncompressed 24/32-bit BMP\n", src);
+    }
+    ok = ok && image_build_mipmaps(&arena, &image) &&
+         write_texture_file(dst, src, &image);
+    arena_free(&arena);
+    return ok;
+}
+
+// Without a GL context the shader cannot be compiled here, so this only
+// catches mistakes that would certainly fail later: a missing #version
+// line, no main function, or unbalanced brackets.
+static bool validate_shader(const char* src, const char* p, size_t len) {
+    const char* end = p + len;
+    const char* s = p;
+    while (s < end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')) {
+        s++;
+    }
+    if ((size_t)(end - s) < 8 || memcmp(s, "#version", 8) != 0) {
+        fprintf(stderr, "%s: does not start with #version\n", src);
+        return false;
+    }
+    bool has_main = false;
+    char stack[64];
+    int depth = 0;
+    int line = 1;
+    for (s = p; s < end; s++) {
+        if (*s == '\n') {
+            line++;
+        } else if (*s == '/' && s + 1 < end && s[1] == '/') {
+            while (s + 1 < end && s[1] != '\n') {
+                s++;
+            }
+        } else if (*s == '(' || *s == '{' || *s == '[') {
+            if (depth == (int)sizeof stack) {
+                fprintf(stderr, "%s:%d: brackets nested too deep\n", src, line);
+                return false;
+            }
+            stack[depth++] = *s == '(' ? ')' : *s == '{' ? '}' : ']';
+        } else if (*s == ')' || *s == '}' || *s == ']') {
+            if (depth == 0 || stack[depth - 1] != *s) {
+                fprintf(stderr, "%s:%d: unexpected '%c'\n", src, line, *s);
+                return false;
+            }
+            depth--;
+        } else if (end - s >= 9 && memcmp(s, "void main", 9) == 0) {
+            has_main = true;
+        }
+    }
+    if (depth != 0) {
+        fprintf(stderr, "%s: missing '%c' at end of file\n", src,
+                stack[depth - 1]);
+        return false;
+    }
+    if (!has_main) {
+        fprintf(stderr, "%s: no main function\n", src);
+        return false;
+    }
+    return true;
+}
+
+// Writes data to dst through a temporary file.
+static bool write_copy(const char* dst, const char* data, size_t len) {
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof tmp_path, "%s.tmp", dst);
+    FILE* f = fopen(tmp_path, "wb");
+    bool ok = f && fwrite(data, 1, len, f) == len;
+    if (f) {
+        ok = fclose(f) == 0 && ok;
+    }
+    if (!ok || rename(tmp_path, dst) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+static bool cook_shader(const char* src, const char* dst) {
+    MappedFile file;
+    if (!map_file(&file, src)) {
+        return false;
+    }
+    bool ok = validate_shader(src, file.data, file.len) &&
+              write_copy(dst, file.data, file.len);
+    unmap_file(&file);
+    return ok;
+}
+
+// Material libraries are small text files read at startup, so they are
+// only checked for materials and copied.
+static bool cook_materials(const char* src, const char* dst) {
+    Arena arena = {0};
+    Material* materials;
+    size_t n_materials;
+    bool ok = read_mtl_file(&arena, src, &materials, &n_materials);
+    arena_free(&arena);
+    if (ok && n_materials == 0) {
+        fprintf(stderr, "%s: no newmtl statements\n", src);
+        ok = false;
+    }
+    MappedFile file;
+    if (!ok || !map_file(&file, src)) {
+        return false;
+    }
+    ok = write_copy(dst, file.data, file.len);
+    unmap_file(&file);
+    return ok;
+}
+
+static void run_task(void* arg) {
+    Task* task = arg;
+    task->ok = task->cook(task->src, task->dst);
+    if (!task->ok) {
+        fprintf(stderr, "Could not cook %s\n", task->src);
+    }
+}
+
+// Chooses the cook function and output name for src.
+static bool plan_task(Task* task, const char* src, const char* out_dir) {
+    const char* base = strrchr(src, '/');
+    base = base ? base + 1 : src;
+    const char* ext = strrchr(base, '.');
+    if (!ext) {
+        return false;
+    }
+    int base_len = ext - base;
+    const char* out_ext;
+    if (strcmp(ext, ".obj") == 0) {
+        task->cook = cook_mesh;
+        out_ext = ".mesh";
+    } else if (strcmp(ext, ".bmp") == 0) {
+        task->cook = cook_texture;
+        out_ext = ".tex";
+    } else if (strcmp(ext, ".vert") == 0 || strcmp(ext, ".frag") == 0) {
+        task->cook = cook_shader;
+        out_ext = ext;
+    } else if (strcmp(ext, ".mtl") == 0) {
+        task->cook = cook_materials;
+        out_ext = ext;
+    } else {
+        return false;
+    }
+    task->src = src;
+    int len = snprintf(task->dst, sizeof task->dst, "%s/%.*s%s",
+                       out_dir, base_len, base, out_ext);
+    return len > 0 && (size_t)len < sizeof task->dst;
+}
+
+static bool up_to_date(const Task* task) {
+    FileInfo src, dst;
+    return stat_file(task->src, &src) && stat_file(task->dst, &dst) &&
+           dst.mtime_ns >= src.mtime_ns;
+}
+
+int main(int argc, char** argv) {
+    bool force = false;
+    int n_threads = 0;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-f") == 0) {
+            force = true;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            n_threads = atoi(argv[++arg]);
+        } else {
+            break;
+        }
+    }
+    if (argc - arg < 2) {
+        fprintf(stderr, "Usage: %s [-f] [-j threads] out_dir input...\n",
+                argv[0]);
+        return 2;
+    }
+    const char* out_dir = argv[arg++];
+    int n_inputs = argc - arg;
+    Task* tasks = calloc(n_inputs, sizeof *tasks);
+    if (!tasks) {
+        return 1;
+    }
+    Pool* pool = n_inputs > 1 ? pool_create(n_threads) : NULL;
+    int status = 0;
+    for (int i = 0; i < n_inputs; i++) {
+        Task* task = &tasks[i];
+        if (!plan_task(task, argv[arg + i], out_dir)) {
+            fprintf(stderr, "Don't know how to cook %s\n", argv[arg + i]);
+            status = 1;
+            continue;
+        }
+        if (!force && up_to_date(task)) {
+            task->ok = true;
+        } else if (pool) {
+            pool_submit(pool, run_task, task);
+        } else {
+            run_task(task);
+        }
+    }
+    if (pool) {
+        pool_destroy(pool);
+    }
+    for (int i = 0; i < n_inputs; i++) {
+        if (tasks[i].src && !tasks[i].ok) {
+            status = 1;
+        }
+    }
+    free(tasks);
+    return status;
+}
@@ -0,0 +1,139 @@
+// Mesh codec benchmark. Cooks OBJ files as assetc does and times
+// decode_vertex_buffer and decode_index_buffer on the result.
+//
+// Usage: bench_codec [-r runs] file.obj...
+//
+// Each buffer is decoded runs times (default 20) and the best time is
+// kept. The results go to stdout as CSV with a header line: the buffer's
+// size decoded and encoded, the ratio of the two, and the decode speed in
+// decoded gigabytes per second. The encoded sizes are what the buffers
+// take in the cooked file. The status is 1 if a buffer does not decode to
+// what was encoded.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "arena.h"
+#include "mesh.h"
+#include "meshcodec.h"
+#include "meshopt.h"
+#include "obj.h"
+#include "simplify.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum {
+    BUFFER_VERTICES,
+    BUFFER_INDICES,
+    N_BUFFERS
+} Buffer;
+
+static const char* buffer_names[N_BUFFERS] = {"vertices", "indices"};
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static bool encode(Arena* arena, const Mesh* mesh, Buffer buffer,
+                   void** out, size_t* out_len) {
+    if (buffer == BUFFER_VERTICES) {
+        return encode_vertex_buffer(arena, mesh->verts, mesh->n_verts,
+                                    MESH_STRIDE * sizeof (float), out,
+                                    out_len);
+    }
+    return encode_index_buffer(arena, mesh->indices, mesh->n_indices,
+                               mesh->index_size, out, out_len);
+}
+
+static bool decode(Arena* arena, const Mesh* mesh, Buffer buffer,
+                   void* out, const void* in, size_t len) {
+    if (buffer == BUFFER_VERTICES) {
+        return decode_vertex_buffer(arena, out, mesh->n_verts,
+                                    MESH_STRIDE * sizeof (float), in, len);
+    }
+    return decode_index_buffer(arena, out, mesh->n_indices,
+                               mesh->index_size, in, len);
+}
+
+static bool bench_file(const char* path, int runs) {
+    Arena arena = {0};
+    Mesh mesh;
+    float acmr_before, acmr_after;
+    if (!read_obj_file(&arena, NULL, path, &mesh) ||
+        !optimize_mesh(&arena, &mesh, &acmr_before, &acmr_after) ||
+        !build_lods(&arena, &mesh)) {
+        fprintf(stderr, "Could not cook %s\n", path);
+        arena_free(&arena);
+        return false;
+    }
+    bool ok = true;
+    for (int b = 0; b < N_BUFFERS && ok; b++) {
+        const void* raw = b == BUFFER_VERTICES ? (const void*)mesh.verts
+                                               : mesh.indices;
+        size_t raw_len = b == BUFFER_VERTICES
+                         ? mesh.n_verts * MESH_STRIDE * sizeof (float)
+                         : mesh.n_indices * mesh.index_size;
+        void* encoded;
+        size_t len;
+        void* decoded = arena_alloc(&arena, raw_len + 1);
+        ok = decoded && encode(&arena, &mesh, b, &encoded, &len);
+        double best = INFINITY;
+        for (int i = 0; i < runs && ok; i++) {
+            // Scratch space is taken from a fresh arena each time, as
+            // load_mesh_file does.
+            Arena scratch = {0};
+            double start = now();
+            ok = decode(&scratch, &mesh, b, decoded, encoded, len);
+            double t = now() - start;
+            arena_free(&scratch);
+            if (t < best) {
+                best = t;
+            }
+        }
+        if (ok && memcmp(decoded, raw, raw_len) != 0) {
+            fprintf(stderr, "%s: %s do not decode to what was encoded\n",
+                    path, buffer_names[b]);
+            ok = false;
+        }
+        if (ok) {
+            printf("%s,%s,%zu,%zu,%.3f,%.6f,%.3f\n", path, buffer_names[b],
+                   raw_len, len, (double)len / raw_len, best,
+                   raw_len / best * 1e-9);
+        }
+    }
+    arena_free(&arena);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int runs = 20;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            runs = atoi(argv[++arg]);
+        } else {
+            break;
+        }
+    }
+    if (arg == argc || argv[arg][0] == '-') {
+        fprintf(stderr, "Usage: %s [-r runs] file.obj...\n", argv[0]);
+        return 2;
+    }
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    printf("file,buffer,bytes,encoded_bytes,ratio,seconds,gb_per_s\n");
+    int status = 0;
+    for (; arg < argc; arg++) {
+        if (!bench_file(argv[arg], runs)) {
+            status = 1;
+        }
+    }
+    return status;
+}
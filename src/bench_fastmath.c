@@ -0,0 +1,223 @@
+// Accuracy and throughput of the approximations in fastmath.h.
+//
+// Usage: bench_fastmath [-n count] [-r runs]
+//
+// Each function is run on count random inputs from its domain (default
+// 1048576) by the C library in single precision, by the scalar fastmath.h
+// function and by its _n version. The results go to stdout as CSV with a
+// header line: the largest error against the C library in double
+// precision, whether it is absolute or relative, and nanoseconds per input
+// from the best of runs (default 5). The error is of the kind fastmath.h
+// documents: absolute for sincos and atan, whose results are near zero
+// somewhere, and relative for rsqrt, whose results span the whole float
+// range. The status is 1 if the _n results differ from the scalar ones or
+// an error is above the maximum documented in fastmath.h.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "fastmath.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PI 3.14159265358979
+
+typedef enum {
+    FN_SINCOS,
+    FN_ATAN,
+    FN_RSQRT,
+    N_FNS
+} Fn;
+
+static const char* fn_names[N_FNS] = {"sincos", "atan", "rsqrt"};
+
+// The maximum errors documented in fastmath.h, absolute for sincos and
+// atan and relative for rsqrt.
+static const double fn_max_errors[N_FNS] = {1e-7, 2e-7, 5e-6};
+static const bool fn_relative[N_FNS] = {false, false, true};
+
+typedef enum {
+    IMPL_LIBM,
+    IMPL_FAST,
+    IMPL_FAST_N,
+    N_IMPLS
+} Impl;
+
+static const char* impl_names[N_IMPLS] = {"libm", "fast", "fast_n"};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+// xorshift64*, uniform in [0, 1).
+static double uniform(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 2685821657736338717ull >> 11) * 0x1p-53;
+}
+
+// Half of the inputs cover the whole supported range and half the range
+// where most calls are.
+static void make_inputs(Fn fn, float* x, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double u = uniform();
+        bool wide = i % 2 == 0;
+        switch (fn) {
+        case FN_SINCOS:
+            x[i] = wide ? (u * 2 - 1) * 8192 : (u * 2 - 1) * 2 * PI;
+            break;
+        case FN_ATAN:
+            x[i] = wide ? tan((u - 0.5) * PI) : (u * 2 - 1) * 4;
+            break;
+        default:
+            x[i] = wide ? ldexp(1 + u, (int)(uniform() * 253) - 126)
+                        : u * 4 + 0x1p-20;
+            break;
+        }
+    }
+}
+
+static void run(Fn fn, Impl impl, const float* x, float* a, float* b,
+                size_t n) {
+    switch (fn) {
+    case FN_SINCOS:
+        if (impl == IMPL_LIBM) {
+            for (size_t i = 0; i < n; i++) {
+                a[i] = sinf(x[i]);
+                b[i] = cosf(x[i]);
+            }
+        } else if (impl == IMPL_FAST) {
+            for (size_t i = 0; i < n; i++) {
+                fast_sincosf(x[i], &a[i], &b[i]);
+            }
+        } else {
+            fast_sincos_n(a, b, x, n);
+        }
+        break;
+    case FN_ATAN:
+        if (impl == IMPL_LIBM) {
+            for (size_t i = 0; i < n; i++) {
+                a[i] = atanf(x[i]);
+            }
+        } else if (impl == IMPL_FAST) {
+            for (size_t i = 0; i < n; i++) {
+                a[i] = fast_atanf(x[i]);
+            }
+        } else {
+            fast_atan_n(a, x, n);
+        }
+        break;
+    default:
+        if (impl == IMPL_LIBM) {
+            for (size_t i = 0; i < n; i++) {
+                a[i] = 1 / sqrtf(x[i]);
+            }
+        } else if (impl == IMPL_FAST) {
+            for (size_t i = 0; i < n; i++) {
+                a[i] = fast_rsqrtf(x[i]);
+            }
+        } else {
+            fast_rsqrt_n(a, x, n);
+        }
+        break;
+    }
+}
+
+static double error(Fn fn, double got, double want) {
+    double e = fabs(got - want);
+    return fn_relative[fn] ? e / fabs(want) : e;
+}
+
+static double max_error(Fn fn, const float* x, const float* a,
+                        const float* b, size_t n) {
+    double err = 0;
+    for (size_t i = 0; i < n; i++) {
+        switch (fn) {
+        case FN_SINCOS:
+            err = fmax(err, error(fn, a[i], sin(x[i])));
+            err = fmax(err, error(fn, b[i], cos(x[i])));
+            break;
+        case FN_ATAN:
+            err = fmax(err, error(fn, a[i], atan(x[i])));
+            break;
+        default:
+            err = fmax(err, error(fn, a[i], 1 / sqrt(x[i])));
+            break;
+        }
+    }
+    return err;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    size_t n = 1 << 20;
+    int runs = 5;
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            n = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            runs = atoi(argv[++arg]);
+        } else {
+            fprintf(stderr, "Usage: %s [-n count] [-r runs]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs < 1) {
+        runs = 1;
+    }
+    float* x = malloc(n * sizeof *x);
+    float* out = malloc(N_IMPLS * 2 * n * sizeof *out);
+    if (!x || !out) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    printf("function,impl,max_error,error_kind,ns_per_op\n");
+    int status = 0;
+    for (int fn = 0; fn < N_FNS; fn++) {
+        make_inputs(fn, x, n);
+        for (int impl = 0; impl < N_IMPLS; impl++) {
+            float* a = out + impl * 2 * n;
+            float* b = a + n;
+            double best = INFINITY;
+            for (int i = 0; i < runs; i++) {
+                double start = now();
+                run(fn, impl, x, a, b, n);
+                double t = now() - start;
+                if (t < best) {
+                    best = t;
+                }
+            }
+            double err = max_error(fn, x, a, b, n);
+            printf("%s,%s,%.3g,%s,%.3f\n", fn_names[fn], impl_names[impl],
+                   err, fn_relative[fn] ? "rel" : "abs", best / n * 1e9);
+            if (impl == IMPL_LIBM) {
+                continue;
+            }
+            if (err > fn_max_errors[fn]) {
+                fprintf(stderr, "%s: %s error %g is above %g\n",
+                        fn_names[fn], impl_names[impl], err,
+                        fn_max_errors[fn]);
+                status = 1;
+            }
+        }
+        float* fast = out + IMPL_FAST * 2 * n;
+        float* fast_n = out + IMPL_FAST_N * 2 * n;
+        size_t n_outputs = fn == FN_SINCOS ? 2 * n : n;
+        if (memcmp(fast, fast_n, n_outputs * sizeof *fast) != 0) {
+            fprintf(stderr, "%s: fast_n differs from fast\n", fn_names[fn]);
+            status = 1;
+        }
+    }
+    free(x);
+    free(out);
+    return status;
+}
@@ -0,0 +1,200 @@
+// Float parser benchmark. Times parse_double against strtod on the numbers
+// of an OBJ file.
+//
+// Usage: bench_float [-n count] [-r runs] [file.obj]
+//
+// The numbers are the coordinates of the v, vt and vn lines of file.obj
+// (default res/house.obj). Each parser goes over them again and again
+// until it has parsed count numbers (default 1000000), and the best time
+// of runs such passes (default 5) is kept. The results go to stdout as CSV
+// with a header line: numbers parsed, seconds and nanoseconds per number.
+// The status is 1 if parse_double gives a different double than strtod
+// for any number or stops at a different character.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "file.h"
+#include "float_parse.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A number in the file, and the same characters in a NUL-terminated copy
+// for strtod.
+typedef struct {
+    const char* begin;
+    const char* end;
+    const char* copy;
+} Token;
+
+typedef enum {
+    PARSER_STRTOD,
+    PARSER_PARSE_DOUBLE,
+    N_PARSERS
+} Parser;
+
+static const char* parser_names[N_PARSERS] = {"strtod", "parse_double"};
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Finds the numbers of the v, vt and vn lines in [p, end). With tokens
+// NULL they are only counted. copies gets the NUL-terminated copies.
+static size_t find_tokens(const char* p, const char* end, Token* tokens,
+                          char* copies) {
+    size_t n = 0;
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        if (!eol) {
+            eol = end;
+        }
+        while (p < eol && is_space(*p)) {
+            p++;
+        }
+        bool attrib = eol - p >= 2 && p[0] == 'v' &&
+                      (is_space(p[1]) ||
+                       ((p[1] == 't' || p[1] == 'n') && eol - p >= 3 &&
+                        is_space(p[2])));
+        if (attrib) {
+            p += p[1] == 't' || p[1] == 'n' ? 2 : 1;
+            for (;;) {
+                while (p < eol && is_space(*p)) {
+                    p++;
+                }
+                if (p == eol) {
+                    break;
+                }
+                const char* tok = p;
+                while (p < eol && !is_space(*p)) {
+                    p++;
+                }
+                if (tokens) {
+                    size_t len = p - tok;
+                    memcpy(copies, tok, len);
+                    copies[len] = '\0';
+                    tokens[n] = (Token){tok, p, copies};
+                    copies += len + 1;
+                }
+                n++;
+            }
+        }
+        p = eol + 1;
+    }
+    return n;
+}
+
+// Parses count numbers, going over the tokens as often as needed, and
+// returns the sum of the results so that the work is not optimized away.
+static double run(Parser parser, const Token* tokens, size_t n_tokens,
+                  size_t count) {
+    double sum = 0;
+    size_t i = 0;
+    for (size_t k = 0; k < count; k++) {
+        double d;
+        if (parser == PARSER_STRTOD) {
+            d = strtod(tokens[i].copy, NULL);
+        } else {
+            parse_double(tokens[i].begin, tokens[i].end, &d);
+        }
+        sum += d;
+        if (++i == n_tokens) {
+            i = 0;
+        }
+    }
+    return sum;
+}
+
+// Whether parse_double agrees with strtod on every token, bit for bit.
+static bool check(const Token* tokens, size_t n_tokens) {
+    bool ok = true;
+    for (size_t i = 0; i < n_tokens; i++) {
+        const Token* t = &tokens[i];
+        char* want_end;
+        double want = strtod(t->copy, &want_end);
+        double got;
+        const char* got_end = parse_double(t->begin, t->end, &got);
+        if (memcmp(&got, &want, sizeof got) != 0 ||
+            got_end - t->begin != want_end - t->copy) {
+            fprintf(stderr, "%s: parse_double gives %.17g, strtod %.17g\n",
+                    t->copy, got, want);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    size_t count = 1000000;
+    int runs = 5;
+    const char* path = "res/house.obj";
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            count = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            runs = atoi(argv[++arg]);
+        } else {
+            break;
+        }
+    }
+    if (arg + 1 == argc) {
+        path = argv[arg];
+    } else if (arg < argc) {
+        fprintf(stderr, "Usage: %s [-n count] [-r runs] [file.obj]\n",
+                argv[0]);
+        return 2;
+    }
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    MappedFile file;
+    if (!map_file(&file, path)) {
+        fprintf(stderr, "Could not read %s\n", path);
+        return 1;
+    }
+    const char* end = file.data + file.len;
+    size_t n_tokens = find_tokens(file.data, end, NULL, NULL);
+    Token* tokens = malloc((n_tokens ? n_tokens : 1) * sizeof *tokens);
+    char* copies = malloc(file.len + n_tokens + 1);
+    if (!tokens || !copies) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    find_tokens(file.data, end, tokens, copies);
+    if (n_tokens == 0) {
+        fprintf(stderr, "%s has no v, vt or vn numbers\n", path);
+        return 1;
+    }
+    int status = check(tokens, n_tokens) ? 0 : 1;
+
+    printf("parser,numbers,seconds,ns_per_number\n");
+    for (int p = 0; p < N_PARSERS; p++) {
+        double best = INFINITY;
+        for (int i = 0; i < runs; i++) {
+            double start = now();
+            volatile double sum = run(p, tokens, n_tokens, count);
+            (void)sum;
+            double t = now() - start;
+            if (t < best) {
+                best = t;
+            }
+        }
+        printf("%s,%zu,%.6f,%.2f\n", parser_names[p], count, best,
+               best / count * 1e9);
+    }
+    free(tokens);
+    free(copies);
+    unmap_file(&file);
+    return status;
+}
@@ -0,0 +1,474 @@
+// Correctness and speed of the operations in linalg.h.
+//
+// Usage: bench_linalg [-n count] [-r runs]
+//
+// Every operation is run on count random inputs (default 4096) by each of
+// its versions: the LinalgImpl implementations the CPU supports for the
+// dispatched operations, and the scalar and _fast versions for the others.
+// The results go to stdout as CSV with a header line: nanoseconds per
+// operation from the best of runs (default 5) passes over the inputs, and
+// the largest error against a double precision reference, relative to the
+// magnitude of the result where that is above 1. The status is 1 if an
+// error is above the tolerance of the operation or a dispatched version
+// differs from linalg_scalar, which the SIMD versions must match exactly.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "linalg.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PI 3.14159265358979
+
+// Each pass over the inputs is repeated until it takes at least this long,
+// so that the clock resolution does not matter.
+#define MIN_PASS_SECONDS 0.01
+
+// Per element, the inputs and outputs of an operation are a few Mat4s,
+// Quats or Vec3s, each padded to four floats so that all of them are
+// aligned. in_floats counts the padding and out_floats does not.
+typedef void RunFn(const LinalgImpl* impl, const float* in, float* out,
+                   size_t n);
+
+typedef struct {
+    const char* name;
+    int in_floats;
+    int out_floats;
+    // Fills in one element of the inputs.
+    void (*make)(float* in);
+    void (*reference)(const float* in, double* out);
+    double tolerance;
+    // Dispatched operations are run by every implementation, the others by
+    // run as "scalar" and by run_fast, if any, as "fast".
+    bool dispatched;
+    RunFn* run;
+    RunFn* run_fast;
+} Op;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+// xorshift64*, uniform in [-1, 1).
+static float uniform(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 2685821657736338717ull >> 40) * 0x1p-23f - 1;
+}
+
+static void make_floats(float* in, int n) {
+    for (int i = 0; i < n; i++) {
+        in[i] = uniform();
+    }
+}
+
+static void make_unit_quat(float* q) {
+    float len;
+    do {
+        make_floats(q, 4);
+        len = sqrtf(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+    } while (len < 0.1f);
+    for (int i = 0; i < 4; i++) {
+        q[i] /= len;
+    }
+}
+
+static void make_affine(float* a) {
+    Transform t;
+    make_floats(t.pos.v, 3);
+    make_unit_quat(t.rot.v);
+    for (int i = 0; i < 3; i++) {
+        t.scale.v[i] = 1.25f + 0.75f * uniform();
+    }
+    Affine m = affine_from_transform(t);
+    memcpy(a, m.v, sizeof m.v);
+}
+
+static void make_mat_mul(float* in) {
+    make_floats(in, 32);
+}
+
+static void make_mat_vec_mul(float* in) {
+    make_floats(in, 19);
+}
+
+static void make_quat_mul(float* in) {
+    make_unit_quat(in);
+    make_unit_quat(in + 4);
+}
+
+static void make_quat_to_mat(float* in) {
+    make_unit_quat(in);
+}
+
+static void make_quat_from_rot(float* in) {
+    make_floats(in, 3);
+    for (int i = 0; i < 3; i++) {
+        in[i] *= PI;
+    }
+}
+
+static void make_vec_norm(float* in) {
+    do {
+        make_floats(in, 3);
+    } while (in[0]*in[0] + in[1]*in[1] + in[2]*in[2] < 0.01f);
+}
+
+static void make_affine_mul(float* in) {
+    make_affine(in);
+    make_affine(in + 12);
+}
+
+static void make_affine_inv(float* in) {
+    make_affine(in);
+}
+
+static void ref_mat_mul(const float* in, double* out) {
+    const float* l = in;
+    const float* r = in + 16;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            double sum = 0;
+            for (int k = 0; k < 4; k++) {
+                sum += (double)l[i*4 + k] * r[k*4 + j];
+            }
+            out[i*4 + j] = sum;
+        }
+    }
+}
+
+static void ref_mat_vec_mul(const float* in, double* out) {
+    const float* v = in + 16;
+    for (int i = 0; i < 3; i++) {
+        out[i] = (double)in[i*4] * v[0] + (double)in[i*4 + 1] * v[1] +
+                 (double)in[i*4 + 2] * v[2];
+    }
+}
+
+static void ref_quat_mul(const float* in, double* out) {
+    double aw = in[0], ax = in[1], ay = in[2], az = in[3];
+    double bw = in[4], bx = in[5], by = in[6], bz = in[7];
+    out[0] = aw*bw - ax*bx - ay*by - az*bz;
+    out[1] = aw*bx + ax*bw + ay*bz - az*by;
+    out[2] = aw*by - ax*bz + ay*bw + az*bx;
+    out[3] = aw*bz + ax*by - ay*bx + az*bw;
+}
+
+static void ref_quat_to_mat(const float* in, double* out) {
+    double w = in[0], x = in[1], y = in[2], z = in[3];
+    double m[16] = {
+        1-2*(y*y+z*z), 2*(x*y-w*z),   2*(w*y+x*z),   0,
+        2*(x*y+w*z),   1-2*(x*x+z*z), 2*(y*z-w*x),   0,
+        2*(x*z-w*y),   2*(w*x+y*z),   1-2*(x*x+y*y), 0,
+        0,             0,             0,             1,
+    };
+    memcpy(out, m, sizeof m);
+}
+
+static void ref_quat_from_rot(const float* in, double* out) {
+    double x = in[0], y = in[1], z = in[2];
+    double a = sqrt(x*x + y*y + z*z);
+    double s = sin(a / 2) / a;
+    out[0] = cos(a / 2);
+    out[1] = x * s;
+    out[2] = y * s;
+    out[3] = z * s;
+}
+
+static void ref_vec_norm(const float* in, double* out) {
+    double x = in[0], y = in[1], z = in[2];
+    double len = sqrt(x*x + y*y + z*z);
+    out[0] = x / len;
+    out[1] = y / len;
+    out[2] = z / len;
+}
+
+static void ref_affine_mul(const float* in, double* out) {
+    const float* l = in;
+    const float* r = in + 12;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            double sum = j == 3 ? l[i*4 + 3] : 0;
+            for (int k = 0; k < 3; k++) {
+                sum += (double)l[i*4 + k] * r[k*4 + j];
+            }
+            out[i*4 + j] = sum;
+        }
+    }
+}
+
+// Gauss-Jordan elimination with partial pivoting on the 3x3 part.
+static void ref_affine_inv(const float* in, double* out) {
+    double a[3][7];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            a[i][j] = in[i*4 + j];
+            a[i][j + 3] = i == j;
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        int p = c;
+        for (int i = c + 1; i < 3; i++) {
+            if (fabs(a[i][c]) > fabs(a[p][c])) {
+                p = i;
+            }
+        }
+        for (int j = 0; j < 6; j++) {
+            double t = a[c][j];
+            a[c][j] = a[p][j];
+            a[p][j] = t;
+        }
+        double d = a[c][c];
+        for (int j = 0; j < 6; j++) {
+            a[c][j] /= d;
+        }
+        for (int i = 0; i < 3; i++) {
+            if (i != c) {
+                double f = a[i][c];
+                for (int j = 0; j < 6; j++) {
+                    a[i][j] -= f * a[c][j];
+                }
+            }
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        double t = 0;
+        for (int j = 0; j < 3; j++) {
+            out[i*4 + j] = a[i][j + 3];
+            t -= a[i][j + 3] * in[j*4 + 3];
+        }
+        out[i*4 + 3] = t;
+    }
+}
+
+static void run_mat_mul(const LinalgImpl* impl, const float* in, float* out,
+                        size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        impl->mat_mul((Mat4*)(out + i*16), (const Mat4*)(in + i*32),
+                      (const Mat4*)(in + i*32 + 16));
+    }
+}
+
+static void run_mat_vec_mul(const LinalgImpl* impl, const float* in,
+                            float* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        impl->mat_vec_mul((Vec3*)(out + i*4), (const Mat4*)(in + i*20),
+                          (const Vec3*)(in + i*20 + 16));
+    }
+}
+
+static void run_quat_mul(const LinalgImpl* impl, const float* in,
+                         float* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        impl->quat_mul((Quat*)(out + i*4), (const Quat*)(in + i*8),
+                       (const Quat*)(in + i*8 + 4));
+    }
+}
+
+static void run_quat_to_mat(const LinalgImpl* impl, const float* in,
+                            float* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        impl->quat_to_mat((Mat4*)(out + i*16), (const Quat*)(in + i*4));
+    }
+}
+
+static void run_quat_from_rot(const LinalgImpl* impl, const float* in,
+                              float* out, size_t n) {
+    (void)impl;
+    for (size_t i = 0; i < n; i++) {
+        Quat q = quat_from_rot(vec3(in[i*4], in[i*4 + 1], in[i*4 + 2]));
+        memcpy(out + i*4, q.v, sizeof q.v);
+    }
+}
+
+static void run_quat_from_rot_fast(const LinalgImpl* impl, const float* in,
+                                   float* out, size_t n) {
+    (void)impl;
+    for (size_t i = 0; i < n; i++) {
+        Quat q = quat_from_rot_fast(vec3(in[i*4], in[i*4 + 1],
+                                         in[i*4 + 2]));
+        memcpy(out + i*4, q.v, sizeof q.v);
+    }
+}
+
+static void run_vec_norm(const LinalgImpl* impl, const float* in,
+                         float* out, size_t n) {
+    (void)impl;
+    for (size_t i = 0; i < n; i++) {
+        Vec3 v = vec_norm(vec3(in[i*4], in[i*4 + 1], in[i*4 + 2]));
+        memcpy(out + i*4, v.v, sizeof v.v);
+    }
+}
+
+static void run_vec_norm_fast(const LinalgImpl* impl, const float* in,
+                              float* out, size_t n) {
+    (void)impl;
+    for (size_t i = 0; i < n; i++) {
+        Vec3 v = vec_norm_fast(vec3(in[i*4], in[i*4 + 1], in[i*4 + 2]));
+        memcpy(out + i*4, v.v, sizeof v.v);
+    }
+}
+
+static void run_affine_mul(const LinalgImpl* impl, const float* in,
+                           float* out, size_t n) {
+    (void)impl;
+    for (size_t i = 0; i < n; i++) {
+        Affine l, r;
+        memcpy(l.v, in + i*24, sizeof l.v);
+        memcpy(r.v, in + i*24 + 12, sizeof r.v);
+        Affine m = affine_mul(l, r);
+        memcpy(out + i*12, m.v, sizeof m.v);
+    }
+}
+
+static void run_affine_inv(const LinalgImpl* impl, const float* in,
+                           float* out, size_t n) {
+    (void)impl;
+    for (size_t i = 0; i < n; i++) {
+        Affine a;
+        memcpy(a.v, in + i*12, sizeof a.v);
+        Affine m = affine_inv(a);
+        memcpy(out + i*12, m.v, sizeof m.v);
+    }
+}
+
+static const Op ops[] = {
+    {"mat_mul", 32, 16, make_mat_mul, ref_mat_mul, 1e-6, true,
+     run_mat_mul, NULL},
+    {"mat_vec_mul", 20, 3, make_mat_vec_mul, ref_mat_vec_mul, 1e-6, true,
+     run_mat_vec_mul, NULL},
+    {"quat_mul", 8, 4, make_quat_mul, ref_quat_mul, 1e-6, true,
+     run_quat_mul, NULL},
+    {"quat_to_mat", 4, 16, make_quat_to_mat, ref_quat_to_mat, 1e-6, true,
+     run_quat_to_mat, NULL},
+    {"quat_from_rot", 4, 4, make_quat_from_rot, ref_quat_from_rot, 2e-5,
+     false, run_quat_from_rot, run_quat_from_rot_fast},
+    {"vec_norm", 4, 3, make_vec_norm, ref_vec_norm, 1e-5, false,
+     run_vec_norm, run_vec_norm_fast},
+    {"affine_mul", 24, 12, make_affine_mul, ref_affine_mul, 1e-6, false,
+     run_affine_mul, NULL},
+    {"affine_inv", 12, 12, make_affine_inv, ref_affine_inv, 1e-5, false,
+     run_affine_inv, NULL},
+};
+
+static int out_stride(const Op* op) {
+    return (op->out_floats + 3) / 4 * 4;
+}
+
+static double max_error(const Op* op, const float* in, const float* out,
+                        size_t n) {
+    double worst = 0;
+    for (size_t i = 0; i < n; i++) {
+        double want[16];
+        op->reference(in + i * op->in_floats, want);
+        for (int j = 0; j < op->out_floats; j++) {
+            double got = out[i * out_stride(op) + j];
+            double e = fabs(got - want[j]) / fmax(1, fabs(want[j]));
+            worst = fmax(worst, e);
+        }
+    }
+    return worst;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Returns the best time per operation in nanoseconds.
+static double time_run(RunFn* run, const LinalgImpl* impl, const float* in,
+                       float* out, size_t n, int runs) {
+    double best = INFINITY;
+    for (int r = 0; r < runs; r++) {
+        size_t reps = 0;
+        double start = now();
+        double t;
+        do {
+            run(impl, in, out, n);
+            reps++;
+            t = now() - start;
+        } while (t < MIN_PASS_SECONDS);
+        best = fmin(best, t / reps);
+    }
+    return best / n * 1e9;
+}
+
+int main(int argc, char** argv) {
+    size_t n = 4096;
+    int runs = 5;
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            n = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            runs = atoi(argv[++arg]);
+        } else {
+            fprintf(stderr, "Usage: %s [-n count] [-r runs]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs < 1) {
+        runs = 1;
+    }
+    if (n < 1) {
+        n = 1;
+    }
+    const LinalgImpl* impls[LINALG_MAX_IMPLS];
+    int n_impls = linalg_impls(impls);
+    // Room for the largest inputs, and the outputs of the scalar version
+    // to compare the others with.
+    size_t bytes = 32 * n * sizeof (float);
+    float* in = aligned_alloc(16, bytes);
+    float* out = aligned_alloc(16, bytes);
+    float* scalar_out = aligned_alloc(16, bytes);
+    if (!in || !out || !scalar_out) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    printf("op,impl,ns_per_op,max_error\n");
+    int status = 0;
+    for (size_t o = 0; o < sizeof ops / sizeof *ops; o++) {
+        const Op* op = &ops[o];
+        memset(in, 0, bytes);
+        for (size_t i = 0; i < n; i++) {
+            op->make(in + i * op->in_floats);
+        }
+        size_t out_bytes = n * out_stride(op) * sizeof (float);
+        int n_versions = op->dispatched ? n_impls : op->run_fast ? 2 : 1;
+        for (int v = 0; v < n_versions; v++) {
+            // linalg_impls lists linalg_scalar last, so it runs first.
+            const LinalgImpl* impl = op->dispatched ? impls[n_impls - 1 - v]
+                                                    : &linalg_scalar;
+            RunFn* run = !op->dispatched && v == 1 ? op->run_fast : op->run;
+            const char* name = op->dispatched ? impl->name
+                               : v == 1 ? "fast" : "scalar";
+            memset(out, 0, out_bytes);
+            double ns = time_run(run, impl, in, out, n, runs);
+            double err = max_error(op, in, out, n);
+            printf("%s,%s,%.2f,%.3g\n", op->name, name, ns, err);
+            fflush(stdout);
+            if (err > op->tolerance) {
+                fprintf(stderr, "%s: %s error %g is above %g\n", op->name,
+                        name, err, op->tolerance);
+                status = 1;
+            }
+            if (v == 0) {
+                memcpy(scalar_out, out, out_bytes);
+            } else if (op->dispatched &&
+                       memcmp(scalar_out, out, out_bytes) != 0) {
+                fprintf(stderr, "%s: %s differs from scalar\n", op->name,
+                        name);
+                status = 1;
+            }
+        }
+    }
+    free(in);
+    free(out);
+    free(scalar_out);
+    return status;
+}
@@ -0,0 +1,565 @@
+// OBJ loader benchmark. Generates synthetic OBJ files and times the OBJ
+// readers on them and on any files given on the command line.
+//
+// Usage: bench_obj [-d dir] [-s size_mb] [-r runs] [-l] [file.obj...]
+//
+// The synthetic files are written to dir (default .) and are about size_mb
+// megabytes each (default 16). They are a wavy grid in four layouts:
+//   pos    positions only, triangles
+//   tex    positions and texture coordinates, triangles
+//   norm   positions and normals, triangles
+//   quad   all three attributes, quads with negative indices
+//
+// Every file is read runs times (default 3) by each reader and the best
+// time is kept. The readers are read_obj_file without and with a pool,
+// stream_obj_file, and load_mesh_file on the file cooked into dir without
+// levels of detail; for the last, MB is the size of the cooked file. With
+// -l the sscanf and atof loader that came before read_obj_file is timed
+// too. It takes time quadratic in the file size, so keep -s small or give
+// only small files; it also reads just one triangle of each quad. The
+// results go to stdout as CSV with a header line: MB/s and faces/s from
+// the best time, the number and total size of heap allocations made by
+// one read, and the peak resident set size of the reads. Allocations are
+// only counted when the build wraps malloc (BENCH_WRAP_MALLOC), and are -1
+// otherwise.
+//
+// The runs of each reader on each file are done in a child process of
+// their own, so that the peak resident set size is theirs alone.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "arena.h"
+#include "file.h"
+#include "mesh.h"
+#include "meshopt.h"
+#include "obj.h"
+#include "pool.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef BENCH_WRAP_MALLOC
+// Linked with -Wl,--wrap=malloc and so on, so every allocation made by the
+// asset code comes through here.
+static atomic_size_t n_allocs;
+static atomic_size_t alloc_bytes;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    atomic_fetch_add(&n_allocs, 1);
+    atomic_fetch_add(&alloc_bytes, size);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    atomic_fetch_add(&n_allocs, 1);
+    atomic_fetch_add(&alloc_bytes, n * size);
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+    atomic_fetch_add(&n_allocs, 1);
+    atomic_fetch_add(&alloc_bytes, size);
+    return __real_realloc(p, size);
+}
+#endif
+
+typedef enum {
+    LAYOUT_POS,
+    LAYOUT_TEX,
+    LAYOUT_NORM,
+    LAYOUT_QUAD,
+    N_LAYOUTS
+} Layout;
+
+static const char* layout_names[N_LAYOUTS] = {"pos", "tex", "norm", "quad"};
+
+// Rough bytes per grid point, used to pick the grid size for a file size.
+static const int layout_point_bytes[N_LAYOUTS] = {60, 120, 130, 140};
+
+// Writes a grid of side * side points. Points are 1-based in row order.
+static bool write_grid(FILE* f, Layout layout, int side) {
+    bool tex = layout == LAYOUT_TEX || layout == LAYOUT_QUAD;
+    bool norm = layout == LAYOUT_NORM || layout == LAYOUT_QUAD;
+    float step = 1.0f / (side - 1);
+    for (int y = 0; y < side; y++) {
+        for (int x = 0; x < side; x++) {
+            float u = x * step, v = y * step;
+            float z = 0.05f * sinf(u * 20) * cosf(v * 20);
+            fprintf(f, "v %.6f %.6f %.6f\n", u * 10, v * 10, z);
+            if (tex) {
+                fprintf(f, "vt %.6f %.6f\n", u, v);
+            }
+            if (norm) {
+                float dx = cosf(u * 20) * cosf(v * 20) * 0.1f;
+                float dy = -sinf(u * 20) * sinf(v * 20) * 0.1f;
+                float len = sqrtf(dx * dx + dy * dy + 1);
+                fprintf(f, "vn %.6f %.6f %.6f\n", -dx / len, -dy / len,
+                        1 / len);
+            }
+        }
+    }
+    long n = (long)side * side;
+    for (int y = 0; y + 1 < side; y++) {
+        for (int x = 0; x + 1 < side; x++) {
+            long c[4] = {
+                (long)y * side + x + 1,
+                (long)y * side + x + 2,
+                (long)(y + 1) * side + x + 2,
+                (long)(y + 1) * side + x + 1,
+            };
+            switch (layout) {
+            case LAYOUT_POS:
+                fprintf(f, "f %ld %ld %ld\nf %ld %ld %ld\n",
+                        c[0], c[1], c[2], c[0], c[2], c[3]);
+                break;
+            case LAYOUT_TEX:
+                fprintf(f, "f %ld/%ld %ld/%ld %ld/%ld\n"
+                        "f %ld/%ld %ld/%ld %ld/%ld\n",
+                        c[0], c[0], c[1], c[1], c[2], c[2],
+                        c[0], c[0], c[2], c[2], c[3], c[3]);
+                break;
+            case LAYOUT_NORM:
+                fprintf(f, "f %ld//%ld %ld//%ld %ld//%ld\n"
+                        "f %ld//%ld %ld//%ld %ld//%ld\n",
+                        c[0], c[0], c[1], c[1], c[2], c[2],
+                        c[0], c[0], c[2], c[2], c[3], c[3]);
+                break;
+            default:
+                // Negative indices count back from the last point.
+                for (int i = 0; i < 4; i++) {
+                    c[i] -= n + 1;
+                }
+                fprintf(f, "f %ld/%ld/%ld %ld/%ld/%ld %ld/%ld/%ld "
+                        "%ld/%ld/%ld\n", c[0], c[0], c[0], c[1], c[1], c[1],
+                        c[2], c[2], c[2], c[3], c[3], c[3]);
+                break;
+            }
+        }
+    }
+    return !ferror(f);
+}
+
+static bool generate(const char* path, Layout layout, size_t size) {
+    int side = (int)sqrt((double)size / layout_point_bytes[layout]);
+    if (side < 2) {
+        side = 2;
+    }
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return false;
+    }
+    bool ok = write_grid(f, layout, side);
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Could not write %s\n", path);
+    }
+    return ok;
+}
+
+// Counts the `f` lines of the file.
+static bool count_faces(const char* path, size_t* n_bytes, size_t* n_faces) {
+    MappedFile file;
+    if (!map_file(&file, path)) {
+        return false;
+    }
+    size_t n = 0;
+    const char* p = file.data;
+    const char* end = p + file.len;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (end - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            n++;
+        }
+        p = memchr(p, '\n', end - p);
+        p = p ? p + 1 : end;
+    }
+    *n_bytes = file.len;
+    *n_faces = n;
+    unmap_file(&file);
+    return true;
+}
+
+// The OBJ loader this project had before read_obj_file, kept as a
+// baseline: sscanf and atof on a NUL-terminated copy of the file, one
+// realloc per record, and three unindexed vertices of 8 floats per face.
+// Like the original it reads only the first three corners of a face.
+static char* legacy_after_char(char* str, char ch) {
+    while (*str != ch) {
+        if (*str == '\0') {
+            return NULL;
+        }
+        str++;
+    }
+    str++;
+    return str;
+}
+
+static void legacy_set_vert(float* f, char* str,
+                            float* verts, size_t n_verts,
+                            float* texs, size_t n_texs,
+                            float* norms, size_t n_norms) {
+    size_t i;
+    i = atoi(str) - 1;
+    if (i < n_verts) {
+        f[0] = verts[i*3];
+        f[1] = verts[i*3+1];
+        f[2] = verts[i*3+2];
+    } else {
+        f[0] = f[1] = f[2] = 0;
+    }
+    str = legacy_after_char(str, '/');
+    if (str != NULL) {
+        i = atoi(str) - 1;
+        if (i < n_texs) {
+            f[3] = texs[i*2];
+            f[4] = texs[i*2+1];
+        } else {
+            f[3] = f[4] = 0;
+        }
+        str = legacy_after_char(str, '/');
+        if (str != NULL) {
+            i = atoi(str) - 1;
+            if (i < n_norms) {
+                f[5] = norms[i*3];
+                f[6] = norms[i*3+1];
+                f[7] = norms[i*3+2];
+            }
+        } else {
+            f[5] = f[6] = f[7] = 0;
+        }
+    } else {
+        f[3] = f[4] = f[5] = f[6] = f[7] = 0;
+    }
+}
+
+static bool read_obj_legacy(const char* path, float** faces,
+                            size_t* n_faces) {
+    *faces = NULL;
+    *n_faces = 0;
+    char* content = read_file(path, NULL);
+    if (!content) {
+        return false;
+    }
+    char* c = content;
+    float* verts = NULL;
+    size_t n_verts = 0;
+    float* texs = NULL;
+    size_t n_texs = 0;
+    float* norms = NULL;
+    size_t n_norms = 0;
+    while (c[0] != '\0') {
+        if (c[0] != '#') {
+            char cmd[8] = {0}, arg1[16] = {0}, arg2[16] = {0}, arg3[16] = {0};
+            sscanf(c, "%7s %15s %15s %15s", cmd, arg1, arg2, arg3);
+            if (strcmp(cmd, "v") == 0) {
+                verts = realloc(verts, (n_verts+1)*3 * sizeof (float));
+                verts[n_verts*3] = atof(arg1);
+                verts[n_verts*3+1] = atof(arg2);
+                verts[n_verts*3+2] = atof(arg3);
+                n_verts++;
+            } else if (strcmp(cmd, "vt") == 0) {
+                texs = realloc(texs, (n_texs+1)*2 * sizeof (float));
+                texs[n_texs*2] = atof(arg1);
+                texs[n_texs*2+1] = atof(arg2);
+                n_texs++;
+            } else if (strcmp(cmd, "vn") == 0) {
+                norms = realloc(norms, (n_norms+1)*3 * sizeof (float));
+                norms[n_norms*3] = atof(arg1);
+                norms[n_norms*3+1] = atof(arg2);
+                norms[n_norms*3+2] = atof(arg3);
+                n_norms++;
+            } else if (strcmp(cmd, "f") == 0) {
+                *faces = realloc(*faces, (*n_faces+1)*24 * sizeof (float));
+                float* f = &(*faces)[*n_faces * 24];
+                legacy_set_vert(f, arg1, verts, n_verts, texs, n_texs,
+                                norms, n_norms);
+                legacy_set_vert(f+8, arg2, verts, n_verts, texs, n_texs,
+                                norms, n_norms);
+                legacy_set_vert(f+16, arg3, verts, n_verts, texs, n_texs,
+                                norms, n_norms);
+                if (f[5] == 0 && f[6] == 0 && f[7] == 0) {
+                    float e1[3], e2[3], n[3];
+                    for (int k = 0; k < 3; k++) {
+                        e1[k] = f[8+k] - f[k];
+                        e2[k] = f[16+k] - f[k];
+                    }
+                    n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+                    n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+                    n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+                    float len = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+                    for (int k = 0; k < 3; k++) {
+                        f[5+k] = f[13+k] = f[21+k] = n[k] / len;
+                    }
+                }
+                (*n_faces)++;
+            }
+        }
+        while (c[0] != '\0' && c[0] != '\n') {
+            c++;
+        }
+        while (c[0] == '\n') {
+            c++;
+        }
+    }
+    free(content);
+    free(norms);
+    free(verts);
+    free(texs);
+    return true;
+}
+
+typedef enum {
+    READER_LEGACY,
+    READER_SERIAL,
+    READER_POOL,
+    READER_STREAM,
+    READER_MESH,
+    N_READERS
+} Reader;
+
+static const char* reader_names[N_READERS] = {
+    "legacy", "serial", "pool", "stream", "mesh",
+};
+
+static bool discard_begin(void* user, const ObjStreamInfo* info) {
+    (void)user;
+    (void)info;
+    return true;
+}
+
+static bool discard_write(void* user, size_t first, const float* verts,
+                          size_t n) {
+    (void)user;
+    (void)first;
+    (void)verts;
+    (void)n;
+    return true;
+}
+
+static bool run_reader(Reader reader, Pool* pool, const char* path,
+                       const char* mesh_path) {
+    if (reader == READER_LEGACY) {
+        float* faces;
+        size_t n_faces;
+        bool ok = read_obj_legacy(path, &faces, &n_faces);
+        free(faces);
+        return ok;
+    }
+    if (reader == READER_STREAM) {
+        ObjStreamSink sink = {discard_begin, discard_write, NULL};
+        return stream_obj_file(path, SIZE_MAX, &sink);
+    }
+    Arena arena = {0};
+    Mesh mesh;
+    bool ok;
+    if (reader == READER_MESH) {
+        MappedFile file;
+        ok = load_mesh_file(&arena, &file, mesh_path, path, &mesh);
+        if (ok) {
+            unmap_file(&file);
+        }
+    } else {
+        ok = read_obj_file(&arena, reader == READER_POOL ? pool : NULL,
+                           path, &mesh);
+    }
+    arena_free(&arena);
+    return ok;
+}
+
+// A reader's runs on a file, or with runs 0 the cooking of the file, done
+// in a child process. The child fills in the results.
+typedef struct {
+    Reader reader;
+    const char* path;
+    const char* mesh_path;
+    int runs;
+    bool ok;
+    double best;
+    long allocs;
+    double alloc_mb;
+    long peak_rss_kb;
+} Job;
+
+// Cooks path into mesh_path as assetc would, except for the levels of
+// detail.
+static bool cook(Pool* pool, const char* path, const char* mesh_path) {
+    Arena arena = {0};
+    Mesh mesh;
+    float acmr_before, acmr_after;
+    bool ok = read_obj_file(&arena, pool, path, &mesh) &&
+              optimize_mesh(&arena, &mesh, &acmr_before, &acmr_after) &&
+              write_mesh_file(mesh_path, path, &mesh);
+    arena_free(&arena);
+    return ok;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1;
+}
+
+// Does the job in this process. The pool is made here, since a forked
+// child has none of the parent's threads.
+static void run_job(Job* job) {
+    Pool* pool = job->runs == 0 || job->reader == READER_POOL
+                 ? pool_create(0) : NULL;
+    job->ok = true;
+    job->best = INFINITY;
+    job->allocs = -1;
+    job->alloc_mb = -1;
+    if (job->runs == 0) {
+        job->ok = cook(pool, job->path, job->mesh_path);
+    }
+    for (int i = 0; i < job->runs && job->ok; i++) {
+#ifdef BENCH_WRAP_MALLOC
+        atomic_store(&n_allocs, 0);
+        atomic_store(&alloc_bytes, 0);
+#endif
+        double start = now();
+        job->ok = run_reader(job->reader, pool, job->path, job->mesh_path);
+        double t = now() - start;
+        if (t < job->best) {
+            job->best = t;
+        }
+#ifdef BENCH_WRAP_MALLOC
+        job->allocs = atomic_load(&n_allocs);
+        job->alloc_mb = atomic_load(&alloc_bytes) / (1024.0 * 1024.0);
+#endif
+    }
+    if (pool) {
+        pool_destroy(pool);
+    }
+    job->peak_rss_kb = peak_rss_kb();
+}
+
+// Does the job in a child process and gets the results back through a
+// pipe. The parent never reads a file itself, so the children start out
+// small.
+static bool run_job_in_child(Job* job) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        run_job(job);
+        bool sent = write(fds[1], job, sizeof *job) == sizeof *job;
+        _exit(sent ? 0 : 1);
+    }
+    close(fds[1]);
+    bool ok = pid > 0 && read(fds[0], job, sizeof *job) == sizeof *job;
+    close(fds[0]);
+    int status;
+    ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         WEXITSTATUS(status) == 0 && ok;
+    return ok && job->ok;
+}
+
+static bool bench_file(const char* path, const char* dir, int runs,
+                       bool legacy) {
+    size_t n_bytes, n_faces;
+    if (!count_faces(path, &n_bytes, &n_faces)) {
+        fprintf(stderr, "Could not read %s\n", path);
+        return false;
+    }
+    char mesh_path[512];
+    snprintf(mesh_path, sizeof mesh_path, "%s/bench_cooked.mesh", dir);
+    FileInfo mesh_info;
+    Job cook_job = {.path = path, .mesh_path = mesh_path};
+    if (!run_job_in_child(&cook_job) || !stat_file(mesh_path, &mesh_info)) {
+        fprintf(stderr, "Could not cook %s\n", path);
+        return false;
+    }
+    for (int r = 0; r < N_READERS; r++) {
+        if (r == READER_LEGACY && !legacy) {
+            continue;
+        }
+        double mb = (r == READER_MESH ? mesh_info.size : n_bytes) /
+                    (1024.0 * 1024.0);
+        Job job = {.reader = r, .path = path, .mesh_path = mesh_path,
+                   .runs = runs};
+        if (!run_job_in_child(&job)) {
+            fprintf(stderr, "%s: %s reader failed\n", path, reader_names[r]);
+            return false;
+        }
+        printf("%s,%s,%.3f,%zu,%.6f,%.1f,%.0f,%ld,%.3f,%ld\n", path,
+               reader_names[r], mb, n_faces, job.best, mb / job.best,
+               n_faces / job.best, job.allocs, job.alloc_mb,
+               job.peak_rss_kb);
+        fflush(stdout);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const char* dir = ".";
+    size_t size_mb = 16;
+    int runs = 3;
+    bool legacy = false;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) {
+            dir = argv[++arg];
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            size_mb = strtoul(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            runs = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-l") == 0) {
+            legacy = true;
+        } else {
+            fprintf(stderr, "Usage: %s [-d dir] [-s size_mb] [-r runs] [-l] "
+                    "[file.obj...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs < 1) {
+        runs = 1;
+    }
+
+    char paths[N_LAYOUTS][512];
+    for (int i = 0; i < N_LAYOUTS; i++) {
+        snprintf(paths[i], sizeof paths[i], "%s/bench_%s.obj", dir,
+                 layout_names[i]);
+        if (!generate(paths[i], i, size_mb << 20)) {
+            return 1;
+        }
+    }
+
+    printf("file,reader,mb,faces,seconds,mb_per_s,faces_per_s,allocs,"
+           "alloc_mb,peak_rss_kb\n");
+    int status = 0;
+    for (int i = 0; i < N_LAYOUTS; i++) {
+        if (!bench_file(paths[i], dir, runs, legacy)) {
+            status = 1;
+        }
+    }
+    for (; arg < argc; arg++) {
+        if (!bench_file(argv[arg], dir, runs, legacy)) {
+            status = 1;
+        }
+    }
+    return status;
+}
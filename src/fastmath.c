@@ -0,0 +1,160 @@
+#include "fastmath.h"
+
+// The _n functions do four floats at a time with SSE2 or NEON when the
+// target always has them, and the rest with the scalar functions. F is a
+// vector of floats and U one of their bits.
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FASTMATH_SIMD
+typedef __m128 F;
+typedef __m128i U;
+#define F_LOAD _mm_loadu_ps
+#define F_STORE _mm_storeu_ps
+#define F_SET1 _mm_set1_ps
+#define F_ADD _mm_add_ps
+#define F_SUB _mm_sub_ps
+#define F_MUL _mm_mul_ps
+#define F_DIV _mm_div_ps
+#define F_BITS _mm_castps_si128
+#define F_FROM_BITS _mm_castsi128_ps
+#define F_TO_INT _mm_cvttps_epi32
+#define F_GT(a, b) _mm_castps_si128(_mm_cmpgt_ps(a, b))
+#define U_SET1(x) _mm_set1_epi32((int)(x))
+#define U_ADD _mm_add_epi32
+#define U_SUB _mm_sub_epi32
+#define U_AND _mm_and_si128
+#define U_OR _mm_or_si128
+#define U_XOR _mm_xor_si128
+#define U_SHL _mm_slli_epi32
+#define U_SHR _mm_srli_epi32
+
+// Bits of a where mask is set and of b elsewhere.
+static inline F select(U mask, F a, F b) {
+    __m128 m = _mm_castsi128_ps(mask);
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define FASTMATH_SIMD
+typedef float32x4_t F;
+typedef uint32x4_t U;
+#define F_LOAD vld1q_f32
+#define F_STORE vst1q_f32
+#define F_SET1 vdupq_n_f32
+#define F_ADD vaddq_f32
+#define F_SUB vsubq_f32
+#define F_MUL vmulq_f32
+#define F_DIV vdivq_f32
+#define F_BITS vreinterpretq_u32_f32
+#define F_FROM_BITS vreinterpretq_f32_u32
+#define F_TO_INT(x) vreinterpretq_u32_s32(vcvtq_s32_f32(x))
+#define F_GT vcgtq_f32
+#define U_SET1 vdupq_n_u32
+#define U_ADD vaddq_u32
+#define U_SUB vsubq_u32
+#define U_AND vandq_u32
+#define U_OR vorrq_u32
+#define U_XOR veorq_u32
+#define U_SHL vshlq_n_u32
+#define U_SHR vshrq_n_u32
+
+static inline F select(U mask, F a, F b) {
+    return vbslq_f32(mask, a, b);
+}
+#endif
+
+#ifdef FASTMATH_SIMD
+
+static void sincos4(const float* in, float* sin_out, float* cos_out) {
+    F x = F_LOAD(in);
+    F round = F_SET1(FASTMATH_ROUND);
+    F j = F_SUB(F_ADD(F_MUL(x, F_SET1(FASTMATH_2_PI)), round), round);
+    F r = F_SUB(x, F_MUL(j, F_SET1(FASTMATH_PI_2_A)));
+    r = F_SUB(r, F_MUL(j, F_SET1(FASTMATH_PI_2_B)));
+    r = F_SUB(r, F_MUL(j, F_SET1(FASTMATH_PI_2_C)));
+    F z = F_MUL(r, r);
+    F s = F_ADD(F_SET1(FASTMATH_SIN_2), F_MUL(z, F_SET1(FASTMATH_SIN_3)));
+    s = F_ADD(F_SET1(FASTMATH_SIN_1), F_MUL(z, s));
+    s = F_ADD(r, F_MUL(F_MUL(r, z), s));
+    F c = F_ADD(F_SET1(FASTMATH_COS_2), F_MUL(z, F_SET1(FASTMATH_COS_3)));
+    c = F_ADD(F_SET1(FASTMATH_COS_1), F_MUL(z, c));
+    c = F_ADD(F_SUB(F_SET1(1), F_MUL(F_SET1(0.5f), z)),
+              F_MUL(F_MUL(z, z), c));
+    U q = F_TO_INT(j);
+    U odd = U_SUB(U_SET1(0), U_AND(q, U_SET1(1)));
+    U sin_sign = U_SHL(U_AND(q, U_SET1(2)), 30);
+    U cos_sign = U_SHL(U_AND(U_ADD(q, U_SET1(1)), U_SET1(2)), 30);
+    F sin_r = select(odd, c, s);
+    F cos_r = select(odd, s, c);
+    F_STORE(sin_out, F_FROM_BITS(U_XOR(F_BITS(sin_r), sin_sign)));
+    F_STORE(cos_out, F_FROM_BITS(U_XOR(F_BITS(cos_r), cos_sign)));
+}
+
+static void atan4(const float* in, float* out) {
+    F x = F_LOAD(in);
+    U sign = U_AND(F_BITS(x), U_SET1(0x80000000u));
+    F a = F_FROM_BITS(U_XOR(F_BITS(x), sign));
+    F one = F_SET1(1);
+    U big = F_GT(a, one);
+    F t = select(big, F_DIV(one, a), a);
+    F z = F_MUL(t, t);
+    F p = F_ADD(F_SET1(FASTMATH_ATAN_7), F_MUL(z, F_SET1(FASTMATH_ATAN_8)));
+    p = F_ADD(F_SET1(FASTMATH_ATAN_6), F_MUL(z, p));
+    p = F_ADD(F_SET1(FASTMATH_ATAN_5), F_MUL(z, p));
+    p = F_ADD(F_SET1(FASTMATH_ATAN_4), F_MUL(z, p));
+    p = F_ADD(F_SET1(FASTMATH_ATAN_3), F_MUL(z, p));
+    p = F_ADD(F_SET1(FASTMATH_ATAN_2), F_MUL(z, p));
+    p = F_ADD(F_SET1(FASTMATH_ATAN_1), F_MUL(z, p));
+    F r = F_ADD(t, F_MUL(F_MUL(t, z), p));
+    r = select(big, F_SUB(F_SET1(FASTMATH_PI_2), r), r);
+    F_STORE(out, F_FROM_BITS(U_OR(F_BITS(r), sign)));
+}
+
+static void rsqrt4(const float* in, float* out) {
+    F x = F_LOAD(in);
+    F y = F_FROM_BITS(U_SUB(U_SET1(FASTMATH_RSQRT_MAGIC),
+                            U_SHR(F_BITS(x), 1)));
+    F h = F_MUL(F_SET1(0.5f), x);
+    F three_halves = F_SET1(1.5f);
+    y = F_MUL(y, F_SUB(three_halves, F_MUL(F_MUL(h, y), y)));
+    y = F_MUL(y, F_SUB(three_halves, F_MUL(F_MUL(h, y), y)));
+    F_STORE(out, y);
+}
+
+#endif // FASTMATH_SIMD
+
+void fast_sincos_n(float* sin_x, float* cos_x, const float* x, size_t n) {
+    size_t i = 0;
+#ifdef FASTMATH_SIMD
+    for (; i + 4 <= n; i += 4) {
+        sincos4(x + i, sin_x + i, cos_x + i);
+    }
+#endif
+    for (; i < n; i++) {
+        fast_sincosf(x[i], &sin_x[i], &cos_x[i]);
+    }
+}
+
+void fast_atan_n(float* out, const float* x, size_t n) {
+    size_t i = 0;
+#ifdef FASTMATH_SIMD
+    for (; i + 4 <= n; i += 4) {
+        atan4(x + i, out + i);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = fast_atanf(x[i]);
+    }
+}
+
+void fast_rsqrt_n(float* out, const float* x, size_t n) {
+    size_t i = 0;
+#ifdef FASTMATH_SIMD
+    for (; i + 4 <= n; i += 4) {
+        rsqrt4(x + i, out + i);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = fast_rsqrtf(x[i]);
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Approximations of sin, cos, atan and 1/sqrt made of multiplications,
+// additions, rounding and bit operations, without branches or table
+// lookups, so the same steps run in SIMD lanes: the _n functions at the
+// end do them four at a time and give the same results as the scalar
+// ones. Maximum errors, as measured by bench_fastmath against double
+// precision:
+//   fast_sincosf  1e-7 absolute, for |x| <= 8192
+//   fast_atanf    2e-7 absolute
+//   fast_rsqrtf   5e-6 relative, for positive normal x
+
+#define FASTMATH_2_PI 0.636619772f
+#define FASTMATH_PI_2 1.57079637f
+
+// pi/2 split into three floats, the first two with few enough bits that
+// multiplying them by the quadrant j is exact in the supported range
+// (Cody and Waite).
+#define FASTMATH_PI_2_A 1.5703125f
+#define FASTMATH_PI_2_B 4.837512969970703125e-4f
+#define FASTMATH_PI_2_C 7.54978995489188216e-8f
+
+// Adding and subtracting 1.5 * 2^23 rounds a float below 2^22 to the
+// nearest integer.
+#define FASTMATH_ROUND 12582912.0f
+
+// Minimax polynomials for sin and cos on [-pi/4, pi/4], from Cephes.
+#define FASTMATH_SIN_1 -1.6666654611e-1f
+#define FASTMATH_SIN_2 8.3321608736e-3f
+#define FASTMATH_SIN_3 -1.9515295891e-4f
+#define FASTMATH_COS_1 4.166664568298827e-2f
+#define FASTMATH_COS_2 -1.388731625493765e-3f
+#define FASTMATH_COS_3 2.443315711809948e-5f
+
+// Polynomial for atan on [-1, 1], Abramowitz and Stegun 4.4.49.
+#define FASTMATH_ATAN_1 -0.3333314528f
+#define FASTMATH_ATAN_2 0.1999355085f
+#define FASTMATH_ATAN_3 -0.1420889944f
+#define FASTMATH_ATAN_4 0.1065626393f
+#define FASTMATH_ATAN_5 -0.0752896400f
+#define FASTMATH_ATAN_6 0.0429096138f
+#define FASTMATH_ATAN_7 -0.0161657367f
+#define FASTMATH_ATAN_8 0.0028662257f
+
+// Initial guess for 1/sqrt from the bits of x, refined below.
+#define FASTMATH_RSQRT_MAGIC 0x5f375a86
+
+static inline uint32_t fastmath_bits(float x) {
+    uint32_t u;
+    memcpy(&u, &x, sizeof u);
+    return u;
+}
+
+static inline float fastmath_float(uint32_t u) {
+    float x;
+    memcpy(&x, &u, sizeof x);
+    return x;
+}
+
+// Two Newton steps from the initial guess.
+static inline float fast_rsqrtf(float x) {
+    float y = fastmath_float(FASTMATH_RSQRT_MAGIC - (fastmath_bits(x) >> 1));
+    float h = 0.5f * x;
+    y = y * (1.5f - h*y*y);
+    y = y * (1.5f - h*y*y);
+    return y;
+}
+
+// Reduces x by the multiple j of pi/2 nearest to it and evaluates both
+// polynomials. The quadrant j then picks which one is sin and which cos,
+// and their signs.
+static inline void fast_sincosf(float x, float* sin_x, float* cos_x) {
+    float j = (x*FASTMATH_2_PI + FASTMATH_ROUND) - FASTMATH_ROUND;
+    float r = x - j*FASTMATH_PI_2_A - j*FASTMATH_PI_2_B - j*FASTMATH_PI_2_C;
+    float z = r*r;
+    float s = r + r*z*(FASTMATH_SIN_1 + z*(FASTMATH_SIN_2 +
+                                           z*FASTMATH_SIN_3));
+    float c = 1 - 0.5f*z + z*z*(FASTMATH_COS_1 + z*(FASTMATH_COS_2 +
+                                                    z*FASTMATH_COS_3));
+    uint32_t q = (int32_t)j;
+    uint32_t odd = -(q & 1);
+    uint32_t s_bits = fastmath_bits(s);
+    uint32_t c_bits = fastmath_bits(c);
+    uint32_t sin_r = (c_bits & odd) | (s_bits & ~odd);
+    uint32_t cos_r = (s_bits & odd) | (c_bits & ~odd);
+    *sin_x = fastmath_float(sin_r ^ (q & 2) << 30);
+    *cos_x = fastmath_float(cos_r ^ ((q + 1) & 2) << 30);
+}
+
+static inline float fast_sinf(float x) {
+    float s, c;
+    fast_sincosf(x, &s, &c);
+    return s;
+}
+
+static inline float fast_cosf(float x) {
+    float s, c;
+    fast_sincosf(x, &s, &c);
+    return c;
+}
+
+// Uses atan(a) = pi/2 - atan(1/a) for a = |x| > 1 and copies the sign of
+// x.
+static inline float fast_atanf(float x) {
+    float a = fabsf(x);
+    float t = a > 1 ? 1 / a : a;
+    float z = t*t;
+    float p = FASTMATH_ATAN_7 + z*FASTMATH_ATAN_8;
+    p = FASTMATH_ATAN_6 + z*p;
+    p = FASTMATH_ATAN_5 + z*p;
+    p = FASTMATH_ATAN_4 + z*p;
+    p = FASTMATH_ATAN_3 + z*p;
+    p = FASTMATH_ATAN_2 + z*p;
+    p = FASTMATH_ATAN_1 + z*p;
+    float r = t + t*z*p;
+    r = a > 1 ? FASTMATH_PI_2 - r : r;
+    return copysignf(r, x);
+}
+
+// The functions above for n floats. The outputs may be the inputs.
+void fast_sincos_n(float* sin_x, float* cos_x, const float* x, size_t n);
+void fast_atan_n(float* out, const float* x, size_t n);
+void fast_rsqrt_n(float* out, const float* x, size_t n);
+
+#endif // FASTMATH_H
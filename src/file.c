@@ -0,0 +1,109 @@
+#define _POSIX_C_SOURCE 200809L
+#include "file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+char* read_file(const char* name, size_t* len) {
+    FILE* f = fopen(name, "r");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* str = malloc(size + 1);
+    if (!str) {
+        fclose(f);
+        return NULL;
+    }
+    size_t l, read_len = 0;
+    while ((l = fread(str + read_len, 1, size - read_len, f))) {
+        read_len += l;
+    }
+    fclose(f);
+    str[read_len] = '\0';
+    if (len) {
+        *len = read_len;
+    }
+    return str;
+}
+
+bool map_file(MappedFile* file, const char* name) {
+#ifdef HAVE_MMAP
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+            // Same as madvise(MADV_SEQUENTIAL): read ahead aggressively
+            // and drop pages behind the parser early.
+            posix_madvise(p, st.st_size, POSIX_MADV_SEQUENTIAL);
+            file->data = p;
+            file->len = st.st_size;
+            file->mapped = true;
+            return true;
+        }
+    }
+    close(fd);
+#endif
+    char* data = read_file(name, &file->len);
+    if (!data) {
+        return false;
+    }
+    file->data = data;
+    file->mapped = false;
+    return true;
+}
+
+void unmap_file(MappedFile* file) {
+#ifdef HAVE_MMAP
+    if (file->mapped) {
+        munmap((void*)file->data, file->len);
+    } else
+#endif
+    {
+        free((void*)file->data);
+    }
+    file->data = NULL;
+    file->len = 0;
+    file->mapped = false;
+}
+
+bool stat_file(const char* name, FileInfo* info) {
+#ifdef HAVE_MMAP
+    struct stat st;
+    if (stat(name, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+#ifdef __APPLE__
+    struct timespec mtime = st.st_mtimespec;
+#else
+    struct timespec mtime = st.st_mtim;
+#endif
+    info->size = st.st_size;
+    info->mtime_ns = mtime.tv_sec * (int64_t)1000000000 + mtime.tv_nsec;
+    return true;
+#else
+    (void)name, (void)info;
+    return false;
+#endif
+}
+
+bool source_matches(const char* src_path, const FileInfo* recorded) {
+    FileInfo src;
+    if (!stat_file(src_path, &src)) {
+        return true;
+    }
+    return src.size == recorded->size && src.mtime_ns == recorded->mtime_ns;
+}
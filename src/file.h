@@ -0,0 +1,39 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Read-only view of a whole file. The data is not NUL-terminated.
+typedef struct {
+    const char* data;
+    size_t len;
+    bool mapped;
+} MappedFile;
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime_ns;
+} FileInfo;
+
+// Reads the whole file into a NUL-terminated heap buffer. If len is not
+// NULL, the number of bytes read (without the terminator) is stored there.
+char* read_file(const char* name, size_t* len);
+
+// Maps the file into memory for sequential reading, so it can be parsed
+// in place without a heap copy. Files that cannot be mapped (empty files,
+// pipes, platforms without mmap) are read with read_file instead.
+bool map_file(MappedFile* file, const char* name);
+void unmap_file(MappedFile* file);
+
+// Gets the size and modification time of a regular file.
+bool stat_file(const char* name, FileInfo* info);
+
+// Cooked asset files record the size and modification time of the file
+// they were made from. They are current if the source still matches, or if
+// there is no source at all, as in a build directory with only cooked
+// assets.
+bool source_matches(const char* src_path, const FileInfo* recorded);
+
+#endif // FILE_H
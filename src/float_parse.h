@@ -0,0 +1,10 @@
+#ifndef FLOAT_PARSE_H
+#define FLOAT_PARSE_H
+
+// Parses a decimal floating point number from [p, end) without needing a
+// NUL terminator and without looking at the locale. The result is exactly
+// what strtod gives for the same characters. Returns a pointer past the
+// parsed characters, or p if there was no number.
+const char* parse_double(const char* p, const char* end, double* out);
+
+#endif // FLOAT_PARSE_H
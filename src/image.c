@@ -0,0 +1,203 @@
+#include "image.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEXTURE_FILE_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t src_size;
+    int64_t src_mtime_ns;
+    uint32_t width, height;
+    uint32_t n_levels;
+    uint32_t pad;
+} TextureFileHeader;
+
+static int level_size(int size, int level) {
+    size >>= level;
+    return size > 0 ? size : 1;
+}
+
+int image_level_width(const Image* image, int level) {
+    return level_size(image->width, level);
+}
+
+int image_level_height(const Image* image, int level) {
+    return level_size(image->height, level);
+}
+
+static size_t level_offset(const Image* image, int level) {
+    size_t offset = 0;
+    for (int i = 0; i < level; i++) {
+        offset += (size_t)image_level_width(image, i) *
+                  image_level_height(image, i) * 4;
+    }
+    return offset;
+}
+
+const unsigned char* image_level(const Image* image, int level) {
+    return image->pixels + level_offset(image, level);
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t get_u16(const unsigned char* p) {
+    return p[0] | p[1] << 8;
+}
+
+static bool decode_bmp(Arena* arena, const unsigned char* d, size_t len,
+                       Image* image) {
+    if (len < 54 || d[0] != 'B' || d[1] != 'M') {
+        return false;
+    }
+    uint32_t data_offset = get_u32(d + 10);
+    int32_t width = get_u32(d + 18);
+    int32_t height = get_u32(d + 22);
+    uint16_t bpp = get_u16(d + 28);
+    uint32_t compression = get_u32(d + 30);
+    // Positive heights are stored bottom-up.
+    bool bottom_up = height > 0;
+    if (height < 0) {
+        height = -height;
+    }
+    if (width <= 0 || height <= 0 || compression != 0 ||
+        (bpp != 24 && bpp != 32)) {
+        return false;
+    }
+    size_t bytes = bpp / 8;
+    size_t pitch = ((size_t)width * bytes + 3) / 4 * 4;
+    if (data_offset > len || len - data_offset < pitch * height) {
+        return false;
+    }
+    unsigned char* pixels = arena_alloc(arena, (size_t)width * height * 4);
+    if (!pixels) {
+        return false;
+    }
+    for (int32_t y = 0; y < height; y++) {
+        int32_t src_y = bottom_up ? height - 1 - y : y;
+        const unsigned char* src = d + data_offset + src_y * pitch;
+        unsigned char* dst = pixels + (size_t)y * width * 4;
+        for (int32_t x = 0; x < width; x++) {
+            dst[x*4] = src[x*bytes+2];
+            dst[x*4+1] = src[x*bytes+1];
+            dst[x*4+2] = src[x*bytes];
+            dst[x*4+3] = bytes == 4 ? src[x*bytes+3] : 255;
+        }
+    }
+    *image = (Image){width, height, 1, pixels};
+    return true;
+}
+
+bool read_bmp_file(Arena* arena, const char* path, Image* image) {
+    MappedFile file;
+    if (!map_file(&file, path)) {
+        return false;
+    }
+    bool ok = decode_bmp(arena, (const unsigned char*)file.data, file.len,
+                         image);
+    unmap_file(&file);
+    return ok;
+}
+
+bool image_build_mipmaps(Arena* arena, Image* image) {
+    int n_levels = 1;
+    while (image_level_width(image, n_levels - 1) > 1 ||
+           image_level_height(image, n_levels - 1) > 1) {
+        n_levels++;
+    }
+    Image mip = *image;
+    mip.n_levels = n_levels;
+    mip.pixels = arena_alloc(arena, level_offset(&mip, n_levels));
+    if (!mip.pixels) {
+        return false;
+    }
+    memcpy(mip.pixels, image->pixels, (size_t)image->width * image->height * 4);
+    for (int level = 1; level < n_levels; level++) {
+        const unsigned char* src = image_level(&mip, level - 1);
+        unsigned char* dst = mip.pixels + level_offset(&mip, level);
+        int sw = image_level_width(&mip, level - 1);
+        int sh = image_level_height(&mip, level - 1);
+        int w = image_level_width(&mip, level);
+        int h = image_level_height(&mip, level);
+        for (int y = 0; y < h; y++) {
+            // Odd sizes and 1-pixel sides reuse the last row or column.
+            int y0 = y * 2 < sh ? y * 2 : sh - 1;
+            int y1 = y * 2 + 1 < sh ? y * 2 + 1 : sh - 1;
+            for (int x = 0; x < w; x++) {
+                int x0 = x * 2 < sw ? x * 2 : sw - 1;
+                int x1 = x * 2 + 1 < sw ? x * 2 + 1 : sw - 1;
+                for (int c = 0; c < 4; c++) {
+                    int sum = src[(y0*sw + x0)*4 + c] +
+                              src[(y0*sw + x1)*4 + c] +
+                              src[(y1*sw + x0)*4 + c] +
+                              src[(y1*sw + x1)*4 + c];
+                    dst[(y*w + x)*4 + c] = (sum + 2) / 4;
+                }
+            }
+        }
+    }
+    *image = mip;
+    return true;
+}
+
+bool load_texture_file(MappedFile* file, const char* path,
+                       const char* src_path, Image* image) {
+    if (!map_file(file, path)) {
+        return false;
+    }
+    TextureFileHeader h;
+    if (file->len < sizeof h) {
+        unmap_file(file);
+        return false;
+    }
+    memcpy(&h, file->data, sizeof h);
+    Image im = {h.width, h.height, h.n_levels, NULL};
+    if (memcmp(h.magic, "TEX ", 4) != 0 ||
+        h.version != TEXTURE_FILE_VERSION ||
+        !source_matches(src_path, &(FileInfo){h.src_size, h.src_mtime_ns}) ||
+        h.width == 0 || h.height == 0 || h.n_levels == 0 ||
+        h.n_levels > 32 ||
+        file->len < sizeof h + level_offset(&im, h.n_levels)) {
+        unmap_file(file);
+        return false;
+    }
+    im.pixels = (unsigned char*)file->data + sizeof h;
+    *image = im;
+    return true;
+}
+
+bool write_texture_file(const char* path, const char* src_path,
+                        const Image* image) {
+    FileInfo src;
+    if (!stat_file(src_path, &src)) {
+        return false;
+    }
+    TextureFileHeader h = {
+        .magic = {'T', 'E', 'X', ' '},
+        .version = TEXTURE_FILE_VERSION,
+        .src_size = src.size,
+        .src_mtime_ns = src.mtime_ns,
+        .width = image->width,
+        .height = image->height,
+        .n_levels = image->n_levels,
+    };
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path);
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) {
+        return false;
+    }
+    size_t size = level_offset(image, image->n_levels);
+    bool ok = fwrite(&h, sizeof h, 1, f) == 1 &&
+              fwrite(image->pixels, 1, size, f) == size;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
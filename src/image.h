@@ -0,0 +1,34 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "arena.h"
+#include "file.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// RGBA8 image with its mipmap chain, largest level first. Rows run from the
+// top of the picture down, as in an SDL surface.
+typedef struct {
+    int width, height;
+    int n_levels;
+    unsigned char* pixels;
+} Image;
+
+int image_level_width(const Image* image, int level);
+int image_level_height(const Image* image, int level);
+const unsigned char* image_level(const Image* image, int level);
+
+// Decodes an uncompressed 24- or 32-bit BMP file into a single level image.
+bool read_bmp_file(Arena* arena, const char* path, Image* image);
+// Replaces image with a copy that has the full mipmap chain down to 1x1,
+// each level a 2x2 box filter of the one above.
+bool image_build_mipmaps(Arena* arena, Image* image);
+
+// Cooked textures are a header followed by all levels, ready for
+// glTexSubImage2D. Staleness works as for cooked meshes.
+bool load_texture_file(MappedFile* file, const char* path,
+                       const char* src_path, Image* image);
+bool write_texture_file(const char* path, const char* src_path,
+                        const Image* image);
+
+#endif // IMAGE_H
@@ -0,0 +1,425 @@
+#include "linalg.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINALG_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define LINALG_NEON
+#endif
+
+// The SIMD versions do the same operations in the same order as the
+// scalar ones, without fused multiply-adds, so they give the same results
+// bit for bit.
+
+static void mat_mul_scalar(Mat4* out, const Mat4* l, const Mat4* r) {
+    *out = mat_mul(*l, *r);
+}
+
+static void mat_vec_mul_scalar(Vec3* out, const Mat4* l, const Vec3* r) {
+    *out = mat_vec_mul(*l, *r);
+}
+
+static void quat_mul_scalar(Quat* out, const Quat* a, const Quat* b) {
+    *out = quat_mul(*a, *b);
+}
+
+static void quat_to_mat_scalar(Mat4* out, const Quat* q) {
+    *out = quat_to_mat(*q);
+}
+
+static void mat_col_scalar(Mat4Col* out, const Mat4* m) {
+    *out = mat_col(*m);
+}
+
+static Vec3Soa vec3_soa_at(Vec3Soa s, size_t i) {
+    return (Vec3Soa){s.x + i, s.y + i, s.z + i};
+}
+
+static QuatSoa quat_soa_at(QuatSoa s, size_t i) {
+    return (QuatSoa){s.w + i, s.x + i, s.y + i, s.z + i};
+}
+
+static TransformSoa transform_soa_at(TransformSoa s, size_t i) {
+    return (TransformSoa){
+        vec3_soa_at(s.pos, i), quat_soa_at(s.rot, i), vec3_soa_at(s.scale, i)
+    };
+}
+
+static void mat_vec_mul_n_scalar(Vec3Soa out, const Mat4* l, Vec3Soa r,
+                                 size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        Vec3 v = mat_vec_mul(*l, vec3(r.x[i], r.y[i], r.z[i]));
+        out.x[i] = v.x;
+        out.y[i] = v.y;
+        out.z[i] = v.z;
+    }
+}
+
+static void mat_point_mul_n_scalar(Vec3Soa out, const Mat4* l, Vec3Soa r,
+                                   size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        Vec3 v = mat_point_mul(*l, vec3(r.x[i], r.y[i], r.z[i]));
+        out.x[i] = v.x;
+        out.y[i] = v.y;
+        out.z[i] = v.z;
+    }
+}
+
+static void mat_from_transform_n_scalar(Mat4* out, TransformSoa t,
+                                        size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = mat_from_transform((Transform){
+            vec3(t.pos.x[i], t.pos.y[i], t.pos.z[i]),
+            quat(t.rot.w[i], t.rot.x[i], t.rot.y[i], t.rot.z[i]),
+            vec3(t.scale.x[i], t.scale.y[i], t.scale.z[i]),
+        });
+    }
+}
+
+static void quat_norm_n_scalar(QuatSoa out, QuatSoa q, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        Quat r = quat_norm(quat(q.w[i], q.x[i], q.y[i], q.z[i]));
+        out.w[i] = r.w;
+        out.x[i] = r.x;
+        out.y[i] = r.y;
+        out.z[i] = r.z;
+    }
+}
+
+const LinalgImpl linalg_scalar = {
+    "scalar",
+    mat_mul_scalar,
+    mat_vec_mul_scalar,
+    quat_mul_scalar,
+    quat_to_mat_scalar,
+    mat_col_scalar,
+    mat_vec_mul_n_scalar,
+    mat_point_mul_n_scalar,
+    mat_from_transform_n_scalar,
+    quat_norm_n_scalar,
+};
+
+#ifdef LINALG_X86
+
+// Row i of the product is the rows of r scaled by the entries of row i of
+// l.
+__attribute__((target("sse2")))
+static void mat_mul_sse2(Mat4* out, const Mat4* l, const Mat4* r) {
+    __m128 r0 = _mm_load_ps(&r->v[0]);
+    __m128 r1 = _mm_load_ps(&r->v[4]);
+    __m128 r2 = _mm_load_ps(&r->v[8]);
+    __m128 r3 = _mm_load_ps(&r->v[12]);
+    for (int i = 0; i < 16; i += 4) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(l->v[i]), r0);
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(l->v[i + 1]), r1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(l->v[i + 2]), r2));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(l->v[i + 3]), r3));
+        _mm_store_ps(&out->v[i], row);
+    }
+}
+
+// Sums the columns of l scaled by the components of r.
+__attribute__((target("sse2")))
+static void mat_vec_mul_sse2(Vec3* out, const Mat4* l, const Vec3* r) {
+    __m128 c0 = _mm_load_ps(&l->v[0]);
+    __m128 c1 = _mm_load_ps(&l->v[4]);
+    __m128 c2 = _mm_load_ps(&l->v[8]);
+    __m128 c3 = _mm_load_ps(&l->v[12]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    __m128 v = _mm_mul_ps(c0, _mm_set1_ps(r->x));
+    v = _mm_add_ps(v, _mm_mul_ps(c1, _mm_set1_ps(r->y)));
+    v = _mm_add_ps(v, _mm_mul_ps(c2, _mm_set1_ps(r->z)));
+    float res[4];
+    _mm_storeu_ps(res, v);
+    memcpy(out->v, res, sizeof out->v);
+}
+
+// Each term of the product is one component of a times b with its
+// components reordered and some negated.
+__attribute__((target("sse2")))
+static void quat_mul_sse2(Quat* out, const Quat* a, const Quat* b) {
+    __m128 bv = _mm_load_ps(b->v);
+    __m128 b1 = _mm_shuffle_ps(bv, bv, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 b2 = _mm_shuffle_ps(bv, bv, _MM_SHUFFLE(1, 0, 3, 2));
+    __m128 b3 = _mm_shuffle_ps(bv, bv, _MM_SHUFFLE(0, 1, 2, 3));
+    // _mm_set_ps takes the lanes from z down to w.
+    b1 = _mm_xor_ps(b1, _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f));
+    b2 = _mm_xor_ps(b2, _mm_set_ps(-0.0f, 0.0f, 0.0f, -0.0f));
+    b3 = _mm_xor_ps(b3, _mm_set_ps(0.0f, 0.0f, -0.0f, -0.0f));
+    __m128 q = _mm_mul_ps(_mm_set1_ps(a->w), bv);
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_set1_ps(a->x), b1));
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_set1_ps(a->y), b2));
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_set1_ps(a->z), b3));
+    _mm_store_ps(out->v, q);
+}
+
+// Computes the diagonal and the sums and differences of the off-diagonal
+// products as vectors, then places them.
+__attribute__((target("sse2")))
+static void quat_to_mat_sse2(Mat4* out, const Quat* q) {
+    __m128 v = _mm_load_ps(q->v);
+    // Lanes w, x, y, z.
+    __m128 xxy = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 2, 1, 1));
+    __m128 yzz = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 3, 3, 2));
+    __m128 yxx = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 1, 2));
+    __m128 zzy = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 2, 3, 3));
+    __m128 www = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128 zyx = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3));
+    __m128 two = _mm_set1_ps(2);
+    // (yy + zz, xx + zz, xx + yy)
+    __m128 sq = _mm_add_ps(_mm_mul_ps(yxx, yxx), _mm_mul_ps(zzy, zzy));
+    __m128 diag = _mm_sub_ps(_mm_set1_ps(1), _mm_mul_ps(two, sq));
+    // (xy, xz, yz) and (wz, wy, wx)
+    __m128 p = _mm_mul_ps(xxy, yzz);
+    __m128 w = _mm_mul_ps(www, zyx);
+    float g[4], s[4], d[4];
+    _mm_storeu_ps(g, diag);
+    _mm_storeu_ps(s, _mm_mul_ps(two, _mm_add_ps(p, w)));
+    _mm_storeu_ps(d, _mm_mul_ps(two, _mm_sub_ps(p, w)));
+    *out = mat4(
+        g[0], d[0], s[1], 0,
+        s[0], g[1], d[2], 0,
+        d[1], s[2], g[2], 0,
+        0,    0,    0,    1
+    );
+}
+
+__attribute__((target("sse2")))
+static void mat_col_sse2(Mat4Col* out, const Mat4* m) {
+    __m128 r0 = _mm_load_ps(&m->v[0]);
+    __m128 r1 = _mm_load_ps(&m->v[4]);
+    __m128 r2 = _mm_load_ps(&m->v[8]);
+    __m128 r3 = _mm_load_ps(&m->v[12]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_store_ps(&out->v[0], r0);
+    _mm_store_ps(&out->v[4], r1);
+    _mm_store_ps(&out->v[8], r2);
+    _mm_store_ps(&out->v[12], r3);
+}
+
+#define BATCH(name) name##_sse2
+#define BATCH_ATTR __attribute__((target("sse2")))
+#define F __m128
+#define W 4
+#define LOAD _mm_loadu_ps
+#define STORE _mm_storeu_ps
+#define SET1 _mm_set1_ps
+#define ADD _mm_add_ps
+#define SUB _mm_sub_ps
+#define MUL _mm_mul_ps
+#define DIV _mm_div_ps
+#define SQRT _mm_sqrt_ps
+#include "linalg_batch.h"
+#undef BATCH
+#undef BATCH_ATTR
+#undef F
+#undef W
+#undef LOAD
+#undef STORE
+#undef SET1
+#undef ADD
+#undef SUB
+#undef MUL
+#undef DIV
+#undef SQRT
+
+static const LinalgImpl linalg_sse2 = {
+    "sse2",
+    mat_mul_sse2,
+    mat_vec_mul_sse2,
+    quat_mul_sse2,
+    quat_to_mat_sse2,
+    mat_col_sse2,
+    mat_vec_mul_n_sse2,
+    mat_point_mul_n_sse2,
+    mat_from_transform_n_sse2,
+    quat_norm_n_sse2,
+};
+
+// Two rows of the product at a time: each 128-bit lane of a 256-bit
+// register holds one row. Mat4 is only 16-byte aligned, so the 256-bit
+// loads and stores are unaligned ones.
+__attribute__((target("avx")))
+static void mat_mul_avx(Mat4* out, const Mat4* l, const Mat4* r) {
+    __m256 r0 = _mm256_broadcast_ps((const __m128*)&r->v[0]);
+    __m256 r1 = _mm256_broadcast_ps((const __m128*)&r->v[4]);
+    __m256 r2 = _mm256_broadcast_ps((const __m128*)&r->v[8]);
+    __m256 r3 = _mm256_broadcast_ps((const __m128*)&r->v[12]);
+    for (int i = 0; i < 16; i += 8) {
+        __m256 ls = _mm256_loadu_ps(&l->v[i]);
+        __m256 row = _mm256_mul_ps(_mm256_shuffle_ps(ls, ls, 0x00), r0);
+        row = _mm256_add_ps(row, _mm256_mul_ps(
+            _mm256_shuffle_ps(ls, ls, 0x55), r1));
+        row = _mm256_add_ps(row, _mm256_mul_ps(
+            _mm256_shuffle_ps(ls, ls, 0xaa), r2));
+        row = _mm256_add_ps(row, _mm256_mul_ps(
+            _mm256_shuffle_ps(ls, ls, 0xff), r3));
+        _mm256_storeu_ps(&out->v[i], row);
+    }
+}
+
+#define BATCH(name) name##_avx
+#define BATCH_ATTR __attribute__((target("avx")))
+#define F __m256
+#define W 8
+#define LOAD _mm256_loadu_ps
+#define STORE _mm256_storeu_ps
+#define SET1 _mm256_set1_ps
+#define ADD _mm256_add_ps
+#define SUB _mm256_sub_ps
+#define MUL _mm256_mul_ps
+#define DIV _mm256_div_ps
+#define SQRT _mm256_sqrt_ps
+#include "linalg_batch.h"
+#undef BATCH
+#undef BATCH_ATTR
+#undef F
+#undef W
+#undef LOAD
+#undef STORE
+#undef SET1
+#undef ADD
+#undef SUB
+#undef MUL
+#undef DIV
+#undef SQRT
+
+// The single-element operations other than mat_mul have no more than four
+// lanes of work.
+static const LinalgImpl linalg_avx = {
+    "avx",
+    mat_mul_avx,
+    mat_vec_mul_sse2,
+    quat_mul_sse2,
+    quat_to_mat_sse2,
+    mat_col_sse2,
+    mat_vec_mul_n_avx,
+    mat_point_mul_n_avx,
+    mat_from_transform_n_avx,
+    quat_norm_n_avx,
+};
+
+#endif // LINALG_X86
+
+#ifdef LINALG_NEON
+
+static void mat_mul_neon(Mat4* out, const Mat4* l, const Mat4* r) {
+    float32x4_t r0 = vld1q_f32(&r->v[0]);
+    float32x4_t r1 = vld1q_f32(&r->v[4]);
+    float32x4_t r2 = vld1q_f32(&r->v[8]);
+    float32x4_t r3 = vld1q_f32(&r->v[12]);
+    for (int i = 0; i < 16; i += 4) {
+        float32x4_t row = vmulq_n_f32(r0, l->v[i]);
+        row = vaddq_f32(row, vmulq_n_f32(r1, l->v[i + 1]));
+        row = vaddq_f32(row, vmulq_n_f32(r2, l->v[i + 2]));
+        row = vaddq_f32(row, vmulq_n_f32(r3, l->v[i + 3]));
+        vst1q_f32(&out->v[i], row);
+    }
+}
+
+static void mat_vec_mul_neon(Vec3* out, const Mat4* l, const Vec3* r) {
+    float32x4x4_t c = vld4q_f32(l->v);
+    float32x4_t v = vmulq_n_f32(c.val[0], r->x);
+    v = vaddq_f32(v, vmulq_n_f32(c.val[1], r->y));
+    v = vaddq_f32(v, vmulq_n_f32(c.val[2], r->z));
+    float res[4];
+    vst1q_f32(res, v);
+    memcpy(out->v, res, sizeof out->v);
+}
+
+static void quat_mul_neon(Quat* out, const Quat* a, const Quat* b) {
+    float32x4_t bv = vld1q_f32(b->v);
+    // (x, w, z, y), (y, z, w, x) and (z, y, x, w) with signs applied.
+    float32x4_t b1 = vrev64q_f32(bv);
+    float32x4_t b2 = vextq_f32(bv, bv, 2);
+    float32x4_t b3 = vrev64q_f32(b2);
+    static const float s1[4] = {-1, 1, -1, 1};
+    static const float s2[4] = {-1, 1, 1, -1};
+    static const float s3[4] = {-1, -1, 1, 1};
+    b1 = vmulq_f32(b1, vld1q_f32(s1));
+    b2 = vmulq_f32(b2, vld1q_f32(s2));
+    b3 = vmulq_f32(b3, vld1q_f32(s3));
+    float32x4_t q = vmulq_n_f32(bv, a->w);
+    q = vaddq_f32(q, vmulq_n_f32(b1, a->x));
+    q = vaddq_f32(q, vmulq_n_f32(b2, a->y));
+    q = vaddq_f32(q, vmulq_n_f32(b3, a->z));
+    vst1q_f32(out->v, q);
+}
+
+// vld4q_f32 splits the rows into columns as it loads them.
+static void mat_col_neon(Mat4Col* out, const Mat4* m) {
+    float32x4x4_t c = vld4q_f32(m->v);
+    vst1q_f32(&out->v[0], c.val[0]);
+    vst1q_f32(&out->v[4], c.val[1]);
+    vst1q_f32(&out->v[8], c.val[2]);
+    vst1q_f32(&out->v[12], c.val[3]);
+}
+
+#define BATCH(name) name##_neon
+#define BATCH_ATTR
+#define F float32x4_t
+#define W 4
+#define LOAD vld1q_f32
+#define STORE vst1q_f32
+#define SET1 vdupq_n_f32
+#define ADD vaddq_f32
+#define SUB vsubq_f32
+#define MUL vmulq_f32
+#define DIV vdivq_f32
+#define SQRT vsqrtq_f32
+#include "linalg_batch.h"
+#undef BATCH
+#undef BATCH_ATTR
+#undef F
+#undef W
+#undef LOAD
+#undef STORE
+#undef SET1
+#undef ADD
+#undef SUB
+#undef MUL
+#undef DIV
+#undef SQRT
+
+static const LinalgImpl linalg_neon = {
+    "neon",
+    mat_mul_neon,
+    mat_vec_mul_neon,
+    quat_mul_neon,
+    quat_to_mat_scalar,
+    mat_col_neon,
+    mat_vec_mul_n_neon,
+    mat_point_mul_n_neon,
+    mat_from_transform_n_neon,
+    quat_norm_n_neon,
+};
+
+#endif // LINALG_NEON
+
+const LinalgImpl* linalg = &linalg_scalar;
+
+int linalg_impls(const LinalgImpl* impls[LINALG_MAX_IMPLS]) {
+    int n = 0;
+#ifdef LINALG_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        impls[n++] = &linalg_avx;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        impls[n++] = &linalg_sse2;
+    }
+#endif
+#ifdef LINALG_NEON
+    impls[n++] = &linalg_neon;
+#endif
+    impls[n++] = &linalg_scalar;
+    return n;
+}
+
+void linalg_init(void) {
+    const LinalgImpl* impls[LINALG_MAX_IMPLS];
+    linalg_impls(impls);
+    linalg = impls[0];
+}
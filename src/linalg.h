@@ -1,8 +1,10 @@
 #ifndef LINALG_H
 #define LINALG_H
 
+#include "fastmath.h"
 #include <math.h>
 #include <float.h>
+#include <stddef.h>
 
 typedef union {
     float v[3];
@@ -11,15 +13,16 @@ typedef union {
     };
 } Vec3;
 
+// Quat and Mat4 are 16-byte aligned for the SIMD kernels below.
 typedef union {
-    float v[4];
+    _Alignas(16) float v[4];
     struct {
         float w, x, y, z;
     };
 } Quat;
 
 typedef union {
-    float v[4*4];
+    _Alignas(16) float v[4*4];
     struct {
         float xx, xy, xz, xw;
         float yx, yy, yz, yw;
@@ -28,6 +31,51 @@ typedef union {
     };
 } Mat4;
 
+// An affine transform: the top three rows of a Mat4 whose bottom row is
+// 0, 0, 0, 1. Composing two takes 36 multiplications instead of 64.
+typedef union {
+    _Alignas(16) float v[3*4];
+    struct {
+        float xx, xy, xz, xw;
+        float yx, yy, yz, yw;
+        float zx, zy, zz, zw;
+    };
+} Affine;
+
+// A matrix stored column by column: what glUniformMatrix4fv takes with
+// transpose GL_FALSE, and the layout of a mat4 in a std140 uniform block.
+// Mat4 is stored row by row.
+typedef struct {
+    _Alignas(16) float v[4*4];
+} Mat4Col;
+
+typedef struct {
+    Vec3 pos;
+    Quat rot;
+    Vec3 scale;
+} Transform;
+
+// Arrays of vectors, quaternions and transforms stored as one array per
+// component, for the batch functions below.
+typedef struct {
+    float* x;
+    float* y;
+    float* z;
+} Vec3Soa;
+
+typedef struct {
+    float* w;
+    float* x;
+    float* y;
+    float* z;
+} QuatSoa;
+
+typedef struct {
+    Vec3Soa pos;
+    QuatSoa rot;
+    Vec3Soa scale;
+} TransformSoa;
+
 static inline Vec3 vec3(float x, float y, float z) {
     return (Vec3){{x, y, z}};
 }
@@ -48,12 +96,22 @@ static inline Mat4 mat4(float xx, float xy, float xz, float xw,
     }};
 }
 
+static inline Affine affine(float xx, float xy, float xz, float xw,
+                            float yx, float yy, float yz, float yw,
+                            float zx, float zy, float zz, float zw) {
+    return (Affine){{
+        xx, xy, xz, xw,
+        yx, yy, yz, yw,
+        zx, zy, zz, zw,
+    }};
+}
+
 static inline float vec_dot(Vec3 v1, Vec3 v2) {
     return v1.x*v2.x + v1.y*v2.y + v1.z*v2.z;
 }
 
 static inline Vec3 vec_cross(Vec3 v1, Vec3 v2) {
-    return vec3(v1.y*v2.z - v1.z-v2.y,
+    return vec3(v1.y*v2.z - v1.z*v2.y,
                 v1.z*v2.x - v1.x*v2.z,
                 v1.x*v2.y - v1.y*v2.x);
 }
@@ -82,6 +140,12 @@ static inline Vec3 vec_norm(Vec3 v) {
     return vec_scale(v, 1.0f / vec_len(v));
 }
 
+// Like vec_norm, with fast_rsqrtf. Only faster than vec_norm where sqrt
+// and division are slow; see bench_linalg.
+static inline Vec3 vec_norm_fast(Vec3 v) {
+    return vec_scale(v, fast_rsqrtf(vec_len_sq(v)));
+}
+
 static inline Vec3 vec_neg(Vec3 v) {
     return vec_scale(v, -1);
 }
@@ -117,6 +181,21 @@ static inline Quat quat_from_rot(Vec3 rot) {
     );
 }
 
+// Like quat_from_rot, with fast_sincosf. The angle is still computed with
+// sqrtf, which bench_linalg found faster than fast_rsqrtf and its
+// refinement for a single value. Meant for code that makes many
+// rotations at once; the camera makes a few per frame and keeps the exact
+// quat_from_rot, whose errors do not add up in the fly camera.
+static inline Quat quat_from_rot_fast(Vec3 rot) {
+    float a = vec_len(rot);
+    if (a < FLT_EPSILON) {
+        return quat(1, 0, 0, 0);
+    }
+    float s, c;
+    fast_sincosf(a/2, &s, &c);
+    return quat(c, s*rot.x/a, s*rot.y/a, s*rot.z/a);
+}
+
 static inline Quat quat_mul(Quat a, Quat b) {
     return quat(
         a.w*b.w - a.x*b.x - a.y*b.y - a.z*b.z,
@@ -126,6 +205,11 @@ static inline Quat quat_mul(Quat a, Quat b) {
     );
 }
 
+static inline Quat quat_norm(Quat q) {
+    float s = 1.0f / sqrtf(q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z);
+    return quat(q.w*s, q.x*s, q.y*s, q.z*s);
+}
+
 static inline Mat4 quat_to_mat(Quat q) {
     return mat4(
         1-2*(q.y*q.y+q.z*q.z), 2*(q.x*q.y-q.w*q.z),   2*(q.w*q.y+q.x*q.z),   0,
@@ -180,6 +264,31 @@ static inline Vec3 mat_vec_mul(Mat4 l, Vec3 r) {
     );
 }
 
+// Like mat_vec_mul, but also adds the translation of l.
+static inline Vec3 mat_point_mul(Mat4 l, Vec3 r) {
+    return vec3(
+        l.xx*r.x + l.xy*r.y + l.xz*r.z + l.xw,
+        l.yx*r.x + l.yy*r.y + l.yz*r.z + l.yw,
+        l.zx*r.x + l.zy*r.y + l.zz*r.z + l.zw
+    );
+}
+
+// Transforms p by the inverse of m, e.g. to get the camera position in
+// model space. Uses the cross product form of the 3x3 inverse.
+static inline Vec3 affine_inv_point_mul(Affine m, Vec3 p) {
+    Vec3 c0 = vec3(m.xx, m.yx, m.zx);
+    Vec3 c1 = vec3(m.xy, m.yy, m.zy);
+    Vec3 c2 = vec3(m.xz, m.yz, m.zz);
+    Vec3 r0 = vec_cross(c1, c2);
+    float inv_det = 1 / vec_dot(c0, r0);
+    Vec3 d = vec3(p.x - m.xw, p.y - m.yw, p.z - m.zw);
+    return vec3(
+        vec_dot(r0, d) * inv_det,
+        vec_dot(vec_cross(c2, c0), d) * inv_det,
+        vec_dot(vec_cross(c0, c1), d) * inv_det
+    );
+}
+
 static inline Mat4 mat_mul(Mat4 l, Mat4 r) {
     return mat4(
         l.xx*r.xx + l.xy*r.yx + l.xz*r.zx + l.xw*r.wx,
@@ -201,4 +310,154 @@ static inline Mat4 mat_mul(Mat4 l, Mat4 r) {
     );
 }
 
+static inline Mat4Col mat_col(Mat4 m) {
+    return (Mat4Col){{
+        m.xx, m.yx, m.zx, m.wx,
+        m.xy, m.yy, m.zy, m.wy,
+        m.xz, m.yz, m.zz, m.wz,
+        m.xw, m.yw, m.zw, m.ww,
+    }};
+}
+
+static inline Mat4 mat_from_affine(Affine a) {
+    return mat4(
+        a.xx, a.xy, a.xz, a.xw,
+        a.yx, a.yy, a.yz, a.yw,
+        a.zx, a.zy, a.zz, a.zw,
+        0,    0,    0,    1
+    );
+}
+
+// The transform that scales, then rotates, then translates by t.
+static inline Affine affine_from_transform(Transform t) {
+    Mat4 r = quat_to_mat(t.rot);
+    return affine(
+        r.xx*t.scale.x, r.xy*t.scale.y, r.xz*t.scale.z, t.pos.x,
+        r.yx*t.scale.x, r.yy*t.scale.y, r.yz*t.scale.z, t.pos.y,
+        r.zx*t.scale.x, r.zy*t.scale.y, r.zz*t.scale.z, t.pos.z
+    );
+}
+
+static inline Mat4 mat_from_transform(Transform t) {
+    return mat_from_affine(affine_from_transform(t));
+}
+
+static inline Vec3 affine_point_mul(Affine l, Vec3 r) {
+    return vec3(
+        l.xx*r.x + l.xy*r.y + l.xz*r.z + l.xw,
+        l.yx*r.x + l.yy*r.y + l.yz*r.z + l.yw,
+        l.zx*r.x + l.zy*r.y + l.zz*r.z + l.zw
+    );
+}
+
+// The transform that applies r, then l.
+static inline Affine affine_mul(Affine l, Affine r) {
+    return affine(
+        l.xx*r.xx + l.xy*r.yx + l.xz*r.zx,
+        l.xx*r.xy + l.xy*r.yy + l.xz*r.zy,
+        l.xx*r.xz + l.xy*r.yz + l.xz*r.zz,
+        l.xx*r.xw + l.xy*r.yw + l.xz*r.zw + l.xw,
+        l.yx*r.xx + l.yy*r.yx + l.yz*r.zx,
+        l.yx*r.xy + l.yy*r.yy + l.yz*r.zy,
+        l.yx*r.xz + l.yy*r.yz + l.yz*r.zz,
+        l.yx*r.xw + l.yy*r.yw + l.yz*r.zw + l.yw,
+        l.zx*r.xx + l.zy*r.yx + l.zz*r.zx,
+        l.zx*r.xy + l.zy*r.yy + l.zz*r.zy,
+        l.zx*r.xz + l.zy*r.yz + l.zz*r.zz,
+        l.zx*r.xw + l.zy*r.yw + l.zz*r.zw + l.zw
+    );
+}
+
+// The rows of the inverse of the 3x3 part are the cross products of pairs
+// of its columns over the determinant, and the inverse translation is
+// them applied to the negated translation. m must not be singular.
+static inline Affine affine_inv(Affine m) {
+    Vec3 c0 = vec3(m.xx, m.yx, m.zx);
+    Vec3 c1 = vec3(m.xy, m.yy, m.zy);
+    Vec3 c2 = vec3(m.xz, m.yz, m.zz);
+    Vec3 r0 = vec_cross(c1, c2);
+    float inv_det = 1 / vec_dot(c0, r0);
+    r0 = vec_scale(r0, inv_det);
+    Vec3 r1 = vec_scale(vec_cross(c2, c0), inv_det);
+    Vec3 r2 = vec_scale(vec_cross(c0, c1), inv_det);
+    Vec3 t = vec3(m.xw, m.yw, m.zw);
+    return affine(
+        r0.x, r0.y, r0.z, -vec_dot(r0, t),
+        r1.x, r1.y, r1.z, -vec_dot(r1, t),
+        r2.x, r2.y, r2.z, -vec_dot(r2, t)
+    );
+}
+
+// Implementations of the hottest operations, with the same results as the
+// inline versions above, which serve as the reference. out may be one of
+// the inputs.
+typedef struct {
+    const char* name;
+    void (*mat_mul)(Mat4* out, const Mat4* l, const Mat4* r);
+    void (*mat_vec_mul)(Vec3* out, const Mat4* l, const Vec3* r);
+    void (*quat_mul)(Quat* out, const Quat* a, const Quat* b);
+    void (*quat_to_mat)(Mat4* out, const Quat* q);
+    void (*mat_col)(Mat4Col* out, const Mat4* m);
+    // Batch versions that apply the function of the same name without _n
+    // to n elements.
+    void (*mat_vec_mul_n)(Vec3Soa out, const Mat4* l, Vec3Soa r, size_t n);
+    void (*mat_point_mul_n)(Vec3Soa out, const Mat4* l, Vec3Soa r, size_t n);
+    void (*mat_from_transform_n)(Mat4* out, TransformSoa t, size_t n);
+    void (*quat_norm_n)(QuatSoa out, QuatSoa q, size_t n);
+} LinalgImpl;
+
+#define LINALG_MAX_IMPLS 4
+
+// The implementation used by the functions below: linalg_scalar until
+// linalg_init picks the best one for the CPU.
+extern const LinalgImpl* linalg;
+extern const LinalgImpl linalg_scalar;
+
+// Stores the implementations the CPU supports in impls, best first, and
+// returns how many there are. The last one is always linalg_scalar.
+int linalg_impls(const LinalgImpl* impls[LINALG_MAX_IMPLS]);
+void linalg_init(void);
+
+static inline void mat_mul_to(Mat4* out, const Mat4* l, const Mat4* r) {
+    linalg->mat_mul(out, l, r);
+}
+
+static inline void mat_vec_mul_to(Vec3* out, const Mat4* l, const Vec3* r) {
+    linalg->mat_vec_mul(out, l, r);
+}
+
+static inline void quat_mul_to(Quat* out, const Quat* a, const Quat* b) {
+    linalg->quat_mul(out, a, b);
+}
+
+static inline void quat_to_mat_to(Mat4* out, const Quat* q) {
+    linalg->quat_to_mat(out, q);
+}
+
+static inline void mat_col_to(Mat4Col* out, const Mat4* m) {
+    linalg->mat_col(out, m);
+}
+
+// The batch functions read and write whole vectors of the arrays at a
+// time, so an output may be the same arrays as an input but must not
+// overlap it otherwise.
+static inline void mat_vec_mul_n(Vec3Soa out, const Mat4* l, Vec3Soa r,
+                                 size_t n) {
+    linalg->mat_vec_mul_n(out, l, r, n);
+}
+
+static inline void mat_point_mul_n(Vec3Soa out, const Mat4* l, Vec3Soa r,
+                                   size_t n) {
+    linalg->mat_point_mul_n(out, l, r, n);
+}
+
+static inline void mat_from_transform_n(Mat4* out, TransformSoa t,
+                                        size_t n) {
+    linalg->mat_from_transform_n(out, t, n);
+}
+
+static inline void quat_norm_n(QuatSoa out, QuatSoa q, size_t n) {
+    linalg->quat_norm_n(out, q, n);
+}
+
 #endif // LINALG_H
@@ -0,0 +1,120 @@
+// Batch kernels over structure-of-arrays data. linalg.c includes this file
+// once per instruction set, after defining:
+//   BATCH(name)  the name of a kernel for the instruction set
+//   BATCH_ATTR   attributes of the kernels, such as the target
+//   F, W         the vector type and its number of float lanes
+//   LOAD, STORE, SET1, ADD, SUB, MUL, DIV, SQRT
+// The loads and stores are unaligned. Elements left over after the last
+// whole vector go to the scalar kernels, which do the same operations in
+// the same order, so every element gets the same result either way.
+
+BATCH_ATTR
+static void BATCH(mat_vec_mul_n)(Vec3Soa out, const Mat4* l, Vec3Soa r,
+                                 size_t n) {
+    F m[12];
+    for (int k = 0; k < 12; k++) {
+        m[k] = SET1(l->v[k]);
+    }
+    size_t i = 0;
+    for (; i + W <= n; i += W) {
+        F x = LOAD(r.x + i);
+        F y = LOAD(r.y + i);
+        F z = LOAD(r.z + i);
+        F ox = ADD(ADD(MUL(m[0], x), MUL(m[1], y)), MUL(m[2], z));
+        F oy = ADD(ADD(MUL(m[4], x), MUL(m[5], y)), MUL(m[6], z));
+        F oz = ADD(ADD(MUL(m[8], x), MUL(m[9], y)), MUL(m[10], z));
+        STORE(out.x + i, ox);
+        STORE(out.y + i, oy);
+        STORE(out.z + i, oz);
+    }
+    mat_vec_mul_n_scalar(vec3_soa_at(out, i), l, vec3_soa_at(r, i), n - i);
+}
+
+BATCH_ATTR
+static void BATCH(mat_point_mul_n)(Vec3Soa out, const Mat4* l, Vec3Soa r,
+                                   size_t n) {
+    F m[12];
+    for (int k = 0; k < 12; k++) {
+        m[k] = SET1(l->v[k]);
+    }
+    size_t i = 0;
+    for (; i + W <= n; i += W) {
+        F x = LOAD(r.x + i);
+        F y = LOAD(r.y + i);
+        F z = LOAD(r.z + i);
+        F ox = ADD(ADD(ADD(MUL(m[0], x), MUL(m[1], y)), MUL(m[2], z)), m[3]);
+        F oy = ADD(ADD(ADD(MUL(m[4], x), MUL(m[5], y)), MUL(m[6], z)), m[7]);
+        F oz = ADD(ADD(ADD(MUL(m[8], x), MUL(m[9], y)), MUL(m[10], z)),
+                   m[11]);
+        STORE(out.x + i, ox);
+        STORE(out.y + i, oy);
+        STORE(out.z + i, oz);
+    }
+    mat_point_mul_n_scalar(vec3_soa_at(out, i), l, vec3_soa_at(r, i),
+                           n - i);
+}
+
+// Computes each entry of the affine part of W matrices as one vector per
+// entry, then writes the matrices out one entry at a time.
+BATCH_ATTR
+static void BATCH(mat_from_transform_n)(Mat4* out, TransformSoa t,
+                                        size_t n) {
+    F one = SET1(1);
+    F two = SET1(2);
+    size_t i = 0;
+    for (; i + W <= n; i += W) {
+        F qw = LOAD(t.rot.w + i);
+        F qx = LOAD(t.rot.x + i);
+        F qy = LOAD(t.rot.y + i);
+        F qz = LOAD(t.rot.z + i);
+        F sx = LOAD(t.scale.x + i);
+        F sy = LOAD(t.scale.y + i);
+        F sz = LOAD(t.scale.z + i);
+        F xx = MUL(qx, qx), yy = MUL(qy, qy), zz = MUL(qz, qz);
+        F xy = MUL(qx, qy), xz = MUL(qx, qz), yz = MUL(qy, qz);
+        F wx = MUL(qw, qx), wy = MUL(qw, qy), wz = MUL(qw, qz);
+        _Alignas(32) float m[12][W];
+        STORE(m[0], MUL(SUB(one, MUL(two, ADD(yy, zz))), sx));
+        STORE(m[1], MUL(MUL(two, SUB(xy, wz)), sy));
+        STORE(m[2], MUL(MUL(two, ADD(wy, xz)), sz));
+        STORE(m[4], MUL(MUL(two, ADD(xy, wz)), sx));
+        STORE(m[5], MUL(SUB(one, MUL(two, ADD(xx, zz))), sy));
+        STORE(m[6], MUL(MUL(two, SUB(yz, wx)), sz));
+        STORE(m[8], MUL(MUL(two, SUB(xz, wy)), sx));
+        STORE(m[9], MUL(MUL(two, ADD(wx, yz)), sy));
+        STORE(m[10], MUL(SUB(one, MUL(two, ADD(xx, yy))), sz));
+        STORE(m[3], LOAD(t.pos.x + i));
+        STORE(m[7], LOAD(t.pos.y + i));
+        STORE(m[11], LOAD(t.pos.z + i));
+        for (int j = 0; j < W; j++) {
+            Mat4* o = &out[i + j];
+            for (int k = 0; k < 12; k++) {
+                o->v[k] = m[k][j];
+            }
+            o->wx = 0;
+            o->wy = 0;
+            o->wz = 0;
+            o->ww = 1;
+        }
+    }
+    mat_from_transform_n_scalar(out + i, transform_soa_at(t, i), n - i);
+}
+
+BATCH_ATTR
+static void BATCH(quat_norm_n)(QuatSoa out, QuatSoa q, size_t n) {
+    F one = SET1(1);
+    size_t i = 0;
+    for (; i + W <= n; i += W) {
+        F w = LOAD(q.w + i);
+        F x = LOAD(q.x + i);
+        F y = LOAD(q.y + i);
+        F z = LOAD(q.z + i);
+        F len_sq = ADD(ADD(ADD(MUL(w, w), MUL(x, x)), MUL(y, y)), MUL(z, z));
+        F s = DIV(one, SQRT(len_sq));
+        STORE(out.w + i, MUL(w, s));
+        STORE(out.x + i, MUL(x, s));
+        STORE(out.y + i, MUL(y, s));
+        STORE(out.z + i, MUL(z, s));
+    }
+    quat_norm_n_scalar(quat_soa_at(out, i), quat_soa_at(q, i), n - i);
+}
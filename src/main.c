@@ -1,13 +1,41 @@
 #include "linalg.h"
+#include "file.h"
+#include "image.h"
+#include "mesh.h"
+#include "meshopt.h"
+#include "obj.h"
+#include "pool.h"
+#include "simplify.h"
 #include "glad/glad.h"
 #include <SDL.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #define PI 3.14159265358979
 
+// Threads that read assets. Each may keep the shared pool busy parsing a
+// large OBJ file, so a few are enough.
+#define N_LOADERS 2
+
+// The coarsest level of detail is drawn whose error is at most this many
+// pixels on screen.
+#define LOD_MAX_PIXEL_ERROR 1.0f
+
+// Bytes uploaded per frame to meshes that are being refined or streamed,
+// see refine_load and pump_stream.
+#define UPLOAD_BYTES_PER_FRAME (1 << 20)
+
+// CPU memory allowed for streaming a mesh with --stream, see
+// stream_obj_file.
+#define STREAM_MEM_CAP_MB 64
+
+// Uniform buffer binding of the Camera block of the shaders.
+#define CAMERA_BINDING 0
+
 typedef unsigned int uint;
 
 static inline float clamp(float x, float low, float high) {
@@ -27,38 +55,20 @@ enum {
 
 static bool inputs[N_INPUTS];
 
-static char* read_file(const char* name) {
-    FILE* f = fopen(name, "r");
-    if (!f) {
-        return NULL;
-    }
-    fseek(f, 0, SEEK_END);
-    long len = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char* str = malloc(len + 1);
-    if (!str) {
-        fclose(f);
-        return NULL;
-    }
-    size_t l, read_len = 0;
-    while ((l = fread(str + read_len, 1, len - read_len, f))) {
-        read_len += l;
-    }
-    fclose(f);
-    str[read_len] = '\0';
-    return str;
-}
+// Layout of the vertex buffers. The 16-bit formats halve the vertex
+// memory and bandwidth compared to VERTEX_FLOAT.
+static const VertexFormat vertex_format = VERTEX_UNORM16;
 
 static GLuint load_shader(GLenum type, const char* file_name) {
-    char* content = read_file(file_name);
-    if (content == NULL) {
+    MappedFile file;
+    if (!map_file(&file, file_name)) {
         fprintf(stderr, "Could not read shader file %s\n", file_name);
         return 0;
     }
     GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &content, NULL);
-    free(content);
-    content = NULL;
+    GLint len = file.len;
+    glShaderSource(shader, 1, &file.data, &len);
+    unmap_file(&file);
     glCompileShader(shader);
     GLint status = 0;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
@@ -117,12 +127,6 @@ static GLuint load_shaders(const char* name) {
     return program;
 }
 
-typedef struct {
-    Vec3 pos;
-    Quat rot;
-    Vec3 scale;
-} Transform;
-
 typedef struct {
     Vec3 pos;
     float pitch, yaw;
@@ -148,243 +152,1101 @@ static void translate_local_camera(Camera* cam, Vec3 v) {
     cam->pos.z += v.z;
 }
 
-static char* after_char(char* str, char ch) {
-    while (*str != ch) {
-        if (*str == '\0') {
-            return NULL;
-        }
-        str++;
+// A linked program and the locations of the uniforms the renderer sets.
+typedef struct {
+    GLuint program;
+    GLint loc_model;
+    GLint loc_color;
+    GLint loc_pos_scale;
+    GLint loc_pos_offset;
+} Shader;
+
+// A material with its GL state. Materials with a diffuse texture are drawn
+// with the textured shader, the others with the plain one.
+typedef struct {
+    // MTL file and material name, so objects can share materials.
+    char lib[SUBMESH_NAME_SIZE];
+    char name[SUBMESH_NAME_SIZE];
+    const Shader* shader;
+    char texture_name[SUBMESH_NAME_SIZE];
+    GLuint texture;
+    float color[4];
+} DrawMaterial;
+
+#define MAX_MATERIALS 256
+
+// Every material in the scene. Material 0 is plain white, for submeshes
+// without a material.
+typedef struct {
+    Shader shader_tex;
+    Shader shader_plain;
+    DrawMaterial materials[MAX_MATERIALS];
+    int n_materials;
+} Materials;
+
+// Consecutive submeshes of an object with the same material.
+typedef struct {
+    int material;
+    uint32_t first_submesh;
+    uint32_t n_submeshes;
+} DrawRun;
+
+typedef struct {
+    uint vao;
+    uint vbo;
+    uint ibo;
+    // Dequantization of the position attribute, see mesh_pack_vertices.
+    float pos_scale[3];
+    float pos_offset[3];
+    GLuint n_verts;
+    GLuint n_indices;
+    GLenum index_type;
+    GLenum mode;
+    // Parts of the mesh that are culled and given a level of detail on
+    // their own. At the finest level they are drawn through their clusters,
+    // which are culled separately. They are sorted by material.
+    Submesh* submeshes;
+    size_t n_submeshes;
+    int n_lods;
+    // Finest level of detail whose vertices and indices are uploaded.
+    // Finer ones are not drawn until refine_load has uploaded them.
+    int first_lod;
+    Cluster* clusters;
+    size_t n_clusters;
+    DrawRun* runs;
+    size_t n_runs;
+    // Space for the visible clusters and the index ranges to draw.
+    uint32_t* visible;
+    GLsizei* counts;
+    const void** offsets;
+} Obj;
+
+// An object placed in the world. model_col is model as GL takes it.
+typedef struct {
+    const Obj* obj;
+    Affine model;
+    Mat4Col model_col;
+} Instance;
+
+// The Camera uniform block of the shaders in std140 layout, uploaded once
+// per frame.
+typedef struct {
+    Mat4Col view;
+    Mat4Col proj;
+} CameraBlock;
+
+// One run of an instance. A frame goes through these in material order,
+// so every material is bound once.
+typedef struct {
+    const Instance* inst;
+    const DrawRun* run;
+} Draw;
+
+// CPU side of a texture, read on a loader thread.
+typedef struct {
+    // File name as in the MTL file.
+    char name[SUBMESH_NAME_SIZE];
+    bool ok;
+    // A cooked texture, or else the BMP file decoded by SDL.
+    Image image;
+    MappedFile file;
+    SDL_Surface* surf;
+} TextureData;
+
+// Reads res/<name>.tex for the texture file res/<name>.bmp, or the BMP
+// itself if there is no up-to-date cooked texture.
+static bool read_texture(TextureData* t, const char* file) {
+    snprintf(t->name, sizeof t->name, "%s", file);
+    char name[SUBMESH_NAME_SIZE];
+    snprintf(name, sizeof name, "%s", file);
+    char* ext = strrchr(name, '.');
+    if (ext) {
+        *ext = '\0';
+    }
+    char tex_path[512], bmp_path[512];
+    snprintf(tex_path, sizeof tex_path, "res/%s.tex", name);
+    snprintf(bmp_path, sizeof bmp_path, "res/%s.bmp", name);
+    t->surf = NULL;
+    if (load_texture_file(&t->file, tex_path, bmp_path, &t->image)) {
+        t->ok = true;
+        return true;
+    }
+    t->surf = SDL_LoadBMP(bmp_path);
+    t->ok = t->surf != NULL;
+    if (!t->ok) {
+        fprintf(stderr, "Could not load texture %s\n", bmp_path);
     }
-    str++;
-    return str;
+    return t->ok;
 }
-static void set_vert(float* f, char* str,
-                     float* verts, size_t n_verts,
-                     float* texs, size_t n_texs,
-                     float* norms, size_t n_norms) {
-    size_t i;
-    i = atoi(str) - 1;
-    if (i < n_verts) {
-        f[0] = verts[i*3];
-        f[1] = verts[i*3+1];
-        f[2] = verts[i*3+2];
-    } else {
-        f[0] = f[1] = f[2] = 0;
-    }
-    str = after_char(str, '/');
-    if (str != NULL) {
-        i = atoi(str) - 1;
-        if (i < n_texs) {
-            f[3] = texs[i*2];
-            f[4] = texs[i*2+1];
-        } else {
-            f[3] = f[4] = 0;
-        }
-        str = after_char(str, '/');
-        if (str != NULL) {
-            i = atoi(str) - 1;
-            if (i < n_norms) {
-                f[5] = norms[i*3];
-                f[6] = norms[i*3+1];
-                f[7] = norms[i*3+2];
-            }
-        } else {
-            f[5] = f[6] = f[7] = 0;
+
+static void free_texture(TextureData* t) {
+    if (t->surf) {
+        SDL_FreeSurface(t->surf);
+    } else if (t->ok) {
+        unmap_file(&t->file);
+    }
+    t->ok = false;
+}
+
+static GLuint upload_texture(const TextureData* t) {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (!t->surf) {
+        const Image* image = &t->image;
+        glTexStorage2D(GL_TEXTURE_2D, image->n_levels, GL_RGBA8,
+                       image->width, image->height);
+        for (int level = 0; level < image->n_levels; level++) {
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0,
+                            image_level_width(image, level),
+                            image_level_height(image, level),
+                            GL_RGBA, GL_UNSIGNED_BYTE,
+                            image_level(image, level));
         }
-    } else {
-        f[3] = f[4] = f[5] = f[6] = f[7] = 0;
+        return texture;
     }
+
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 256, 256);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 256, GL_BGR,
+                    GL_UNSIGNED_BYTE, t->surf->pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    return texture;
 }
-static bool read_obj_file(const char* name,
-                          float** faces, size_t* n_faces) {
-    char file_name[512] = {0};
-    static const char base_path[] = "res/";
-    size_t name_len = strlen(name);
-    size_t base_len = sizeof base_path - 1;
-    strncpy(file_name, base_path, 511);
-    strncpy(file_name + base_len, name, 511 - base_len);
-    strncpy(file_name + base_len + name_len, ".obj",
-            511 - base_len - name_len);
 
-    *faces = NULL;
-    *n_faces = 0;
-    char* content = read_file(file_name);
-    if (!content) {
-        fprintf(stderr, "Could not read obj file %s\n", file_name);
+static bool shader_setup(Shader* shader, const char* name) {
+    GLuint program = load_shaders(name);
+    if (!program) {
         return false;
     }
-    char* c = content;
-    float* verts = NULL;
-    size_t n_verts = 0;
-    float* texs = NULL;
-    size_t n_texs = 0;
-    float* norms = NULL;
-    size_t n_norms = 0;
-    while (c[0] != '\0') {
-        if (c[0] != '#') {
-            char cmd[8] = {0}, arg1[16] = {0}, arg2[16] = {0}, arg3[16] = {0};
-            sscanf(c, "%7s %15s %15s %15s", cmd, arg1, arg2, arg3);
-            if (strcmp(cmd, "v") == 0) {
-                verts = realloc(verts, (n_verts+1)*3 * sizeof (float));
-                verts[n_verts*3] = atof(arg1);
-                verts[n_verts*3+1] = atof(arg2);
-                verts[n_verts*3+2] = atof(arg3);
-                n_verts++;
-            } else if (strcmp(cmd, "vt") == 0) {
-                texs = realloc(texs, (n_texs+1)*2 * sizeof (float));
-                texs[n_texs*2] = atof(arg1);
-                texs[n_texs*2+1] = atof(arg2);
-                n_texs++;
-            } else if (strcmp(cmd, "vn") == 0) {
-                norms = realloc(norms, (n_norms+1)*3 * sizeof (float));
-                norms[n_norms*3] = atof(arg1);
-                norms[n_norms*3+1] = atof(arg2);
-                norms[n_norms*3+2] = atof(arg3);
-                n_norms++;
-            } else if (strcmp(cmd, "f") == 0) {
-                *faces = realloc(*faces, (*n_faces+1)*24 * sizeof (float));
-                float* f = &(*faces)[*n_faces * 24];
-                set_vert(f, arg1, verts, n_verts, texs, n_texs, norms, n_norms);
-                set_vert(f+8, arg2, verts, n_verts, texs, n_texs, norms, n_norms);
-                set_vert(f+16, arg3, verts, n_verts, texs, n_texs, norms, n_norms);
-                if (f[5] == 0 && f[6] == 0 && f[7] == 0) {
-                    Vec3 v1 = vec3(f[0], f[1], f[2]);
-                    Vec3 v2 = vec3(f[8], f[9], f[10]);
-                    Vec3 v3 = vec3(f[16], f[17], f[18]);
-                    Vec3 norm = vec_cross(vec_to(v1, v2), vec_to(v1, v3));
-                    norm = vec_norm(norm);
-                    f[5] = f[13] = f[21] = norm.x;
-                    f[6] = f[14] = f[22] = norm.y;
-                    f[7] = f[15] = f[23] = norm.z;
-                }
-                (*n_faces)++;
-            }
+    shader->program = program;
+    shader->loc_model = glGetUniformLocation(program, "model");
+    GLuint camera = glGetUniformBlockIndex(program, "Camera");
+    if (camera != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, camera, CAMERA_BINDING);
+    }
+    shader->loc_color = glGetUniformLocation(program, "color");
+    shader->loc_pos_scale = glGetUniformLocation(program, "pos_scale");
+    shader->loc_pos_offset = glGetUniformLocation(program, "pos_offset");
+    return true;
+}
+
+// Returns the texture of an earlier material with the same file, or
+// uploads it from the ones read for the new materials.
+static GLuint material_texture(const Materials* mats, const char* file,
+                               const TextureData* textures,
+                               size_t n_textures) {
+    for (int i = 0; i < mats->n_materials; i++) {
+        const DrawMaterial* m = &mats->materials[i];
+        if (m->texture && strcmp(m->texture_name, file) == 0) {
+            return m->texture;
+        }
+    }
+    for (size_t i = 0; i < n_textures; i++) {
+        if (textures[i].ok && strcmp(textures[i].name, file) == 0) {
+            return upload_texture(&textures[i]);
         }
-        while (c[0] != '\0' && c[0] != '\n') {
-            c++;
+    }
+    return 0;
+}
+
+// Finds the material called name from lib, or adds it from the MTL entry m
+// if there is one. Returns 0, the default material, if there is not.
+static int find_material(Materials* mats, const char* lib, const char* name,
+                         const Material* m, const TextureData* textures,
+                         size_t n_textures) {
+    for (int i = 1; i < mats->n_materials; i++) {
+        const DrawMaterial* dm = &mats->materials[i];
+        if (strncmp(dm->lib, lib, sizeof dm->lib) == 0 &&
+            strncmp(dm->name, name, sizeof dm->name) == 0) {
+            return i;
+        }
+    }
+    if (!m) {
+        return 0;
+    }
+    if (mats->n_materials == MAX_MATERIALS) {
+        fprintf(stderr, "Too many materials, drawing %s plain\n", m->name);
+        return 0;
+    }
+    DrawMaterial* dm = &mats->materials[mats->n_materials];
+    *dm = (DrawMaterial){
+        .shader = &mats->shader_plain,
+        .color = {m->diffuse[0], m->diffuse[1], m->diffuse[2], 1},
+    };
+    snprintf(dm->lib, sizeof dm->lib, "%.*s", (int)sizeof dm->lib - 1, lib);
+    snprintf(dm->name, sizeof dm->name, "%s", m->name);
+    if (m->diffuse_map[0]) {
+        dm->texture = material_texture(mats, m->diffuse_map, textures,
+                                       n_textures);
+        if (dm->texture) {
+            snprintf(dm->texture_name, sizeof dm->texture_name, "%s",
+                     m->diffuse_map);
+            dm->shader = &mats->shader_tex;
         }
-        while (c[0] == '\n') {
-            c++;
+    }
+    return mats->n_materials++;
+}
+
+static bool materials_setup(Materials* mats) {
+    if (!shader_setup(&mats->shader_tex, "shader_tex") ||
+        !shader_setup(&mats->shader_plain, "shader_plain")) {
+        return false;
+    }
+    mats->materials[0] = (DrawMaterial){
+        .shader = &mats->shader_plain,
+        .color = {1, 1, 1, 1},
+    };
+    mats->n_materials = 1;
+    return true;
+}
+
+static void bind_material(const DrawMaterial* m) {
+    const Shader* s = m->shader;
+    glUseProgram(s->program);
+    glBindTexture(GL_TEXTURE_2D, m->texture);
+    glUniform4fv(s->loc_color, 1, m->color);
+}
+
+static GLuint camera_setup(void) {
+    GLuint ubo;
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof (CameraBlock), NULL,
+                 GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, ubo);
+    return ubo;
+}
+
+static void camera_upload(GLuint ubo, Affine view, Mat4 proj) {
+    CameraBlock block;
+    Mat4 view4 = mat_from_affine(view);
+    mat_col_to(&block.view, &view4);
+    mat_col_to(&block.proj, &proj);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof block, &block);
+}
+
+typedef struct {
+    int material;
+    uint32_t index;
+} SubmeshKey;
+
+static int compare_submesh_keys(const void* a, const void* b) {
+    const SubmeshKey* ka = a;
+    const SubmeshKey* kb = b;
+    if (ka->material != kb->material) {
+        return ka->material < kb->material ? -1 : 1;
+    }
+    return ka->index < kb->index ? -1 : ka->index > kb->index;
+}
+
+// Sorts the submeshes of obj by material and makes a run of each material.
+static bool obj_sort_submeshes(Obj* obj, const int* material_of) {
+    size_t n = obj->n_submeshes;
+    SubmeshKey* keys = malloc(n * sizeof *keys);
+    Submesh* sorted = malloc(n * sizeof *sorted);
+    obj->runs = malloc(n * sizeof *obj->runs);
+    if (!keys || !sorted || !obj->runs) {
+        free(keys);
+        free(sorted);
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (SubmeshKey){material_of[i], i};
+    }
+    qsort(keys, n, sizeof *keys, compare_submesh_keys);
+    obj->n_runs = 0;
+    for (size_t i = 0; i < n; i++) {
+        sorted[i] = obj->submeshes[keys[i].index];
+        if (i == 0 || keys[i].material != keys[i - 1].material) {
+            obj->runs[obj->n_runs++] = (DrawRun){keys[i].material, i, 0};
         }
+        obj->runs[obj->n_runs - 1].n_submeshes++;
     }
-    free(content);
-    free(norms);
-    free(verts);
-    free(texs);
+    free(obj->submeshes);
+    obj->submeshes = sorted;
+    free(keys);
     return true;
 }
 
+// Vertices in a GPU layout, see mesh_pack_vertices.
 typedef struct {
-    uint vao;
-    GLuint shader;
-    GLint loc_model;
-    GLint loc_view;
-    GLint loc_proj;
-    GLint loc_color;
-    GLuint n_verts;
-    GLuint texture;
-    GLenum mode;
-} Obj;
+    void* data;
+    float pos_scale[3];
+    float pos_offset[3];
+} PackedVerts;
 
-bool obj_setup(Obj* obj, GLuint shader, const char* texname,
-               float* data, size_t n_data, GLenum mode) {
-    bool use_texture = texname != NULL;
-    size_t stride = 6;
-    if (use_texture) {
-        stride += 2;
+static bool pack_vertices(PackedVerts* verts, const Mesh* mesh,
+                          VertexFormat format) {
+    verts->data = malloc(mesh->n_verts * vertex_format_size(format));
+    if (!verts->data) {
+        return false;
     }
+    mesh_pack_vertices(mesh, format, verts->data, verts->pos_scale,
+                       verts->pos_offset);
+    return true;
+}
 
-    glGenVertexArrays(1, &obj->vao);
-    glBindVertexArray(obj->vao);
+// Uploads mesh, with its vertices already packed, and prepares it for
+// drawing. material_of has the material of each submesh, or of the whole
+// mesh if it has no submeshes. If verts has no data, the vertices have
+// already been streamed to obj->vbo, see stream_mesh.
+//
+// Only the vertices and indices of level of detail first_lod are uploaded;
+// the buffers are made large enough for refine_load to add the rest.
+bool obj_setup(Obj* obj, const Mesh* mesh, const PackedVerts* verts,
+               const int* material_of, VertexFormat format, GLenum mode,
+               int first_lod) {
+    size_t stride = vertex_format_size(format);
+    memcpy(obj->pos_scale, verts->pos_scale, sizeof obj->pos_scale);
+    memcpy(obj->pos_offset, verts->pos_offset, sizeof obj->pos_offset);
+    const MeshLod* lod = &mesh->lods[first_lod];
 
-    uint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, n_data * stride * sizeof *data, data,
-                 GL_STATIC_DRAW);
-
-    if (use_texture) {
-        glGenTextures(1, &obj->texture);
-        glBindTexture(GL_TEXTURE_2D, obj->texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                        GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 256, 256);
-        SDL_Surface* surf = SDL_LoadBMP(texname);
-        if (surf == NULL) {
+    if (verts->data) {
+        glGenVertexArrays(1, &obj->vao);
+        glBindVertexArray(obj->vao);
+        glGenBuffers(1, &obj->vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, obj->vbo);
+        if (first_lod == 0) {
+            glBufferData(GL_ARRAY_BUFFER, mesh->n_verts * stride,
+                         verts->data, GL_STATIC_DRAW);
+        } else {
+            glBufferData(GL_ARRAY_BUFFER, mesh->n_verts * stride, NULL,
+                         GL_STATIC_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, lod->n_verts * stride,
+                            verts->data);
+        }
+    } else {
+        glGenVertexArrays(1, &obj->vao);
+        glBindVertexArray(obj->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, obj->vbo);
+    }
+
+    if (mesh->indices) {
+        size_t index_size = mesh->index_size;
+        glGenBuffers(1, &obj->ibo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, obj->ibo);
+        if (first_lod == 0) {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                         mesh->n_indices * index_size, mesh->indices,
+                         GL_STATIC_DRAW);
+        } else {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                         mesh->n_indices * index_size, NULL, GL_STATIC_DRAW);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                            lod->first_index * index_size,
+                            lod->n_indices * index_size,
+                            (const char*)mesh->indices +
+                            lod->first_index * index_size);
+        }
+        obj->n_lods = mesh->n_lods ? mesh->n_lods : 1;
+        obj->first_lod = first_lod;
+        obj->n_indices = mesh->n_lods ? mesh->lods[0].n_indices
+                                      : mesh->n_indices;
+        obj->index_type = mesh->index_size == 2 ? GL_UNSIGNED_SHORT
+                                                : GL_UNSIGNED_INT;
+
+        // Without submeshes the whole mesh is one.
+        size_t n_subs = mesh->n_submeshes ? mesh->n_submeshes : 1;
+        size_t n = mesh->n_clusters;
+        obj->submeshes = malloc(n_subs * sizeof *obj->submeshes);
+        obj->clusters = malloc((n ? n : 1) * sizeof *obj->clusters);
+        obj->visible = malloc((n ? n : 1) * sizeof *obj->visible);
+        obj->counts = malloc((n + n_subs) * sizeof *obj->counts);
+        obj->offsets = malloc((n + n_subs) * sizeof *obj->offsets);
+        if (!obj->submeshes || !obj->clusters || !obj->visible ||
+            !obj->counts || !obj->offsets) {
             return false;
         }
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 256, GL_BGR,
-                        GL_UNSIGNED_BYTE, surf->pixels);
-        SDL_FreeSurface(surf);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        if (mesh->n_submeshes) {
+            memcpy(obj->submeshes, mesh->submeshes,
+                   n_subs * sizeof *obj->submeshes);
+        } else {
+            Submesh* sub = &obj->submeshes[0];
+            *sub = (Submesh){.n_clusters = n};
+            for (int i = 0; i < obj->n_lods; i++) {
+                sub->lods[i] = mesh->n_lods ? mesh->lods[i]
+                    : (MeshLod){0, mesh->n_indices, 0, mesh->n_verts};
+            }
+            float r_sq = 0;
+            for (int i = 0; i < 3; i++) {
+                float half = (mesh->max[i] - mesh->min[i]) * 0.5f;
+                sub->center[i] = mesh->min[i] + half;
+                r_sq += half * half;
+            }
+            sub->radius = sqrtf(r_sq);
+        }
+        obj->n_submeshes = n_subs;
+        memcpy(obj->clusters, mesh->clusters, n * sizeof *obj->clusters);
+        obj->n_clusters = n;
+        if (!obj_sort_submeshes(obj, material_of)) {
+            return false;
+        }
+    } else {
+        obj->runs = malloc(sizeof *obj->runs);
+        if (!obj->runs) {
+            return false;
+        }
+        obj->runs[0] = (DrawRun){material_of[0], 0, 0};
+        obj->n_runs = 1;
     }
 
-    float* offset = 0;
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride * sizeof *data,
-                          offset);
+    if (format == VERTEX_FLOAT) {
+        float* offset = 0;
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, offset);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, offset + 3);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, offset + 5);
+    } else {
+        char* offset = 0;
+        if (format == VERTEX_HALF) {
+            glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride,
+                                  offset);
+        } else {
+            glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                                  offset);
+        }
+        glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+                              offset + 8);
+        glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+                              offset + 12);
+    }
     glEnableVertexAttribArray(0);
-    offset += 3;
-    if (use_texture) {
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride * sizeof *data,
-                              offset);
-        glEnableVertexAttribArray(1);
-        offset += 2;
-    }
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride * sizeof *data,
-                          offset);
+    glEnableVertexAttribArray(1);
     glEnableVertexAttribArray(2);
-    offset += 3;
-
-    obj->shader = shader;
-    obj->loc_model = glGetUniformLocation(shader, "model");
-    obj->loc_view = glGetUniformLocation(shader, "view");
-    obj->loc_proj = glGetUniformLocation(shader, "proj");
-    obj->loc_color = glGetUniformLocation(shader, "color");
-    obj->n_verts = n_data;
+
+    obj->n_verts = mesh->n_verts;
     obj->mode = mode;
     return true;
 }
 
-static Obj new_rect(GLuint shader) {
-    float ts = 16;
-    float verts[] = {
-        -1, -1, 0, 0, 0, 0, 0, 1,
-        1, -1, 0, 1*ts, 0, 0, 0, 1,
-        -1, 1, 0, 0, 1*ts, 0, 0, 1,
-        1, 1, 0, 1*ts, 1*ts, 0, 0, 1,
-    };
+// A mesh with its materials and textures, read and prepared on a loader
+// thread. The main thread uploads it once done is set, so that all GL
+// calls stay on the thread that owns the context.
+typedef struct {
+    // res/<name>.mesh or .obj, or NULL for a mesh that is already in mesh,
+    // drawn with lib[0].
+    const char* name;
+    // If not 0, res/<name>.obj is streamed into the vertex buffer with at
+    // most this many bytes of CPU memory, see stream_mesh.
+    size_t stream_cap;
+    // The loader thread packs streamed vertices into a window of the
+    // vertex buffer that the main thread maps, see pump_stream. All of
+    // these are guarded by stream_lock. Once stream_info is set, the main
+    // thread creates the buffer. It then maps the vertices from
+    // stream_written up to stream_map_end, with stream_map pointing at
+    // where vertex stream_written goes, and unmaps them once the loader
+    // has written them all. stream_cancel stops the loader.
+    SDL_mutex* stream_lock;
+    SDL_cond* stream_cond;
+    bool stream_info;
+    void* stream_map;
+    size_t stream_map_end;
+    size_t stream_written;
+    bool stream_cancel;
+    // No loader threads: the stream runs on the main thread, which does
+    // its own mapping.
+    bool stream_direct;
+    Obj* obj;
+    GLenum mode;
+    // Parses large OBJ files in parallel.
+    Pool* pool;
+    Arena arena;
+    Mesh mesh;
+    MappedFile file;
+    bool mapped;
+    Material* lib;
+    size_t n_lib;
+    // Textures used by lib, each file once.
+    TextureData* textures;
+    size_t n_textures;
+    PackedVerts verts;
+    bool ok;
+    atomic_bool done;
+    bool finished;
+    // Progressive upload after finish_load, see refine_load: the level
+    // being uploaded, or -1 once all are, and how many of its vertices
+    // and indices are uploaded.
+    int refine_lod;
+    size_t refine_verts;
+    size_t refine_indices;
+} AssetLoad;
+
+// Reads res/<name>.mesh, or res/<name>.obj if the cooked mesh is missing
+// or out of date. In the latter case the cooked mesh is written for the
+// next start.
+static bool read_mesh(AssetLoad* load) {
+    char obj_path[512], mesh_path[512];
+    snprintf(obj_path, sizeof obj_path, "res/%s.obj", load->name);
+    snprintf(mesh_path, sizeof mesh_path, "res/%s.mesh", load->name);
+    if (load_mesh_file(&load->arena, &load->file, mesh_path, obj_path,
+                       &load->mesh)) {
+        load->mapped = true;
+        return true;
+    }
+
+    Arena* arena = &load->arena;
+    Mesh* mesh = &load->mesh;
+    if (!read_obj_file(arena, load->pool, obj_path, mesh)) {
+        return false;
+    }
+    float acmr_before, acmr_after;
+    if (optimize_mesh(arena, mesh, &acmr_before, &acmr_after) &&
+        build_lods(arena, mesh)) {
+        printf("%s: ACMR %.3f -> %.3f, %d levels of detail\n", obj_path,
+               acmr_before, acmr_after, mesh->n_lods);
+    }
+    if (!write_mesh_file(mesh_path, obj_path, mesh)) {
+        fprintf(stderr, "Could not write mesh file %s\n", mesh_path);
+    }
+    return true;
+}
+
+// Reads the material library of load->mesh, if it has one.
+static void read_materials(AssetLoad* load) {
+    if (load->mesh.material_lib[0]) {
+        char path[512];
+        snprintf(path, sizeof path, "res/%s", load->mesh.material_lib);
+        if (!read_mtl_file(&load->arena, path, &load->lib, &load->n_lib)) {
+            load->n_lib = 0;
+        }
+    }
+}
+
+// Reads the textures used by load->lib, each file once.
+static bool read_textures(AssetLoad* load) {
+    load->textures = arena_alloc(&load->arena,
+                                 (load->n_lib + 1) * sizeof *load->textures);
+    if (!load->textures) {
+        return false;
+    }
+    for (size_t i = 0; i < load->n_lib; i++) {
+        const char* file = load->lib[i].diffuse_map;
+        bool seen = !file[0];
+        for (size_t j = 0; j < load->n_textures && !seen; j++) {
+            seen = strcmp(load->textures[j].name, file) == 0;
+        }
+        if (!seen) {
+            read_texture(&load->textures[load->n_textures++], file);
+        }
+    }
+    return true;
+}
+
+static bool read_asset(AssetLoad* load) {
+    if (load->name) {
+        if (!read_mesh(load)) {
+            return false;
+        }
+        read_materials(load);
+    }
+    if (!read_textures(load)) {
+        return false;
+    }
+    return pack_vertices(&load->verts, &load->mesh, vertex_format);
+}
+
+// Does the GL side of a mesh that a loader thread is streaming: creates
+// its vertex buffer once the size is known, unmaps the mapped window once
+// it is filled, and maps the next one. The window is at most *budget
+// bytes, and the budget is reduced by as much, so that streaming counts
+// against the same per-frame upload budget as refine_load. The copy
+// target leaves the vertex array's bindings alone.
+static void pump_stream(AssetLoad* load, size_t* budget) {
+    Obj* obj = load->obj;
+    size_t stride = vertex_format_size(vertex_format);
+    SDL_LockMutex(load->stream_lock);
+    if (!load->stream_info || load->stream_cancel) {
+        SDL_UnlockMutex(load->stream_lock);
+        return;
+    }
+    if (!obj->vbo) {
+        glGenBuffers(1, &obj->vbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, obj->vbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, load->mesh.n_verts * stride, NULL,
+                     GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, obj->vbo);
+    if (load->stream_map && load->stream_written == load->stream_map_end) {
+        if (!glUnmapBuffer(GL_COPY_WRITE_BUFFER)) {
+            load->stream_cancel = true;
+        }
+        load->stream_map = NULL;
+    }
+    size_t first = load->stream_written;
+    size_t n = load->mesh.n_verts - first;
+    if (n > *budget / stride) {
+        n = *budget / stride;
+    }
+    if (!load->stream_map && !load->stream_cancel && n > 0) {
+        *budget -= n * stride;
+        load->stream_map = glMapBufferRange(GL_COPY_WRITE_BUFFER,
+                                            first * stride, n * stride,
+                                            GL_MAP_WRITE_BIT |
+                                            GL_MAP_INVALIDATE_RANGE_BIT);
+        load->stream_map_end = first + n;
+        load->stream_cancel = !load->stream_map;
+    }
+    SDL_CondBroadcast(load->stream_cond);
+    SDL_UnlockMutex(load->stream_lock);
+}
+
+// Pumps every load that is streaming, within *budget bytes in all.
+static void pump_streams(AssetLoad* loads, int n_loads, size_t* budget) {
+    for (int i = 0; i < n_loads; i++) {
+        if (loads[i].stream_cap && !loads[i].finished) {
+            pump_stream(&loads[i], budget);
+        }
+    }
+}
+
+// Stops every load that is streaming, so that the loader threads can be
+// joined without the main thread pumping.
+static void cancel_streams(AssetLoad* loads, int n_loads) {
+    for (int i = 0; i < n_loads; i++) {
+        if (loads[i].stream_cap && !loads[i].finished) {
+            SDL_LockMutex(loads[i].stream_lock);
+            loads[i].stream_cancel = true;
+            SDL_CondBroadcast(loads[i].stream_cond);
+            SDL_UnlockMutex(loads[i].stream_lock);
+        }
+    }
+}
+
+// Starts a streamed mesh: records its size and bounds, so that the main
+// thread can create the vertex buffer.
+static bool stream_begin(void* user, const ObjStreamInfo* info) {
+    AssetLoad* load = user;
+    Mesh* mesh = &load->mesh;
+    SDL_LockMutex(load->stream_lock);
+    mesh->n_verts = info->n_verts;
+    if (mesh->n_verts) {
+        memcpy(mesh->min, info->min, sizeof mesh->min);
+        memcpy(mesh->max, info->max, sizeof mesh->max);
+    }
+    memcpy(mesh->material_lib, info->material_lib, sizeof mesh->material_lib);
+    load->stream_info = true;
+    SDL_UnlockMutex(load->stream_lock);
+    return true;
+}
+
+// Packs a batch of streamed vertices straight into the mapped window of
+// the vertex buffer, waiting for the main thread to map one whenever the
+// batch does not fit. Every batch is packed with the bounds of the whole
+// mesh, so they all get the same dequantization.
+static bool stream_write(void* user, size_t first, const float* verts,
+                         size_t n) {
+    AssetLoad* load = user;
+    size_t stride = vertex_format_size(vertex_format);
+    while (n > 0) {
+        if (load->stream_direct) {
+            pump_stream(load, &(size_t){SIZE_MAX});
+        }
+        SDL_LockMutex(load->stream_lock);
+        while (!load->stream_cancel &&
+               (!load->stream_map ||
+                load->stream_written == load->stream_map_end)) {
+            SDL_CondWait(load->stream_cond, load->stream_lock);
+        }
+        bool cancel = load->stream_cancel;
+        char* window = load->stream_map;
+        size_t k = load->stream_map_end - first;
+        SDL_UnlockMutex(load->stream_lock);
+        if (cancel) {
+            return false;
+        }
+        // The main thread only unmaps the window once it is full, so it
+        // can be written without the lock.
+        if (k > n) {
+            k = n;
+        }
+        Mesh batch = load->mesh;
+        batch.verts = (float*)verts;
+        batch.n_verts = k;
+        mesh_pack_vertices(&batch, vertex_format, window,
+                           load->verts.pos_scale, load->verts.pos_offset);
+        SDL_LockMutex(load->stream_lock);
+        load->stream_map = window + k * stride;
+        load->stream_written = first + k;
+        SDL_UnlockMutex(load->stream_lock);
+        first += k;
+        verts += k * MESH_STRIDE;
+        n -= k;
+    }
+    return true;
+}
+
+// Streams res/<name>.obj into the vertex buffer of load->obj, which
+// obj_setup then finishes, and reads its materials. The mesh is drawn as
+// a plain triangle list with the first material of its library.
+static bool stream_mesh(AssetLoad* load) {
+    char path[512];
+    snprintf(path, sizeof path, "res/%s.obj", load->name);
+    ObjStreamSink sink = {stream_begin, stream_write, load};
+    if (!stream_obj_file(path, load->stream_cap, &sink)) {
+        return false;
+    }
+    read_materials(load);
+    return read_textures(load);
+}
+
+static void run_load(void* arg) {
+    AssetLoad* load = arg;
+    load->ok = load->stream_cap ? stream_mesh(load) : read_asset(load);
+    atomic_store(&load->done, true);
+}
+
+// Frees the CPU side of a load once everything is uploaded.
+static void release_load(AssetLoad* load) {
+    free(load->verts.data);
+    load->verts.data = NULL;
+    if (load->mapped) {
+        unmap_file(&load->file);
+        load->mapped = false;
+    }
+    arena_free(&load->arena);
+}
+
+// Unmaps the last window of a finished stream and frees the handshake.
+// Returns whether every vertex made it into the vertex buffer.
+static bool finish_stream(AssetLoad* load) {
+    if (load->ok) {
+        // Also creates the buffer if the mesh is empty.
+        pump_stream(load, &(size_t){0});
+    }
+    if (load->stream_map) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, load->obj->vbo);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        load->stream_map = NULL;
+    }
+    bool ok = !load->stream_cancel &&
+              load->stream_written == load->mesh.n_verts;
+    SDL_DestroyCond(load->stream_cond);
+    SDL_DestroyMutex(load->stream_lock);
+    return ok;
+}
+
+// Uploads a finished load and makes its object drawable. The CPU side is
+// freed, unless refine_load still has levels of detail to upload. Returns
+// false if the load failed.
+static bool finish_load(Materials* mats, AssetLoad* load) {
+    if (load->stream_cap) {
+        load->ok = finish_stream(load) && load->ok;
+    }
+    const Mesh* mesh = &load->mesh;
+    int first_lod = 0;
+    size_t n = mesh->n_submeshes ? mesh->n_submeshes : 1;
+    int* material_of = malloc(n * sizeof *material_of);
+    bool ok = load->ok && material_of;
+    if (ok) {
+        for (size_t i = 0; i < n; i++) {
+            // A mesh without submeshes gets the first material.
+            const char* name = mesh->n_submeshes ? mesh->submeshes[i].material
+                : load->n_lib ? load->lib[0].name : "";
+            const Material* m = NULL;
+            for (size_t j = 0; j < load->n_lib && !m; j++) {
+                if (strncmp(load->lib[j].name, name,
+                            sizeof load->lib[j].name) == 0) {
+                    m = &load->lib[j];
+                }
+            }
+            material_of[i] = find_material(mats, mesh->material_lib, name, m,
+                                           load->textures, load->n_textures);
+        }
+        // Meshes with levels of detail are drawn at the coarsest one
+        // first, and refined over the next frames.
+        first_lod = mesh->n_lods > 1 && load->verts.data
+                    ? mesh->n_lods - 1 : 0;
+        ok = obj_setup(load->obj, mesh, &load->verts, material_of,
+                       vertex_format, load->mode, first_lod);
+    }
+    free(material_of);
+    for (size_t i = 0; i < load->n_textures; i++) {
+        free_texture(&load->textures[i]);
+    }
+    load->finished = true;
+    load->refine_lod = ok ? first_lod - 1 : -1;
+    load->refine_verts = mesh->lods[first_lod].n_verts;
+    load->refine_indices = 0;
+    if (load->refine_lod < 0) {
+        release_load(load);
+    }
+    return ok;
+}
+
+// Uploads the next part of a mesh that finish_load drew at a coarse level
+// of detail: the vertices the next finer level adds, then its indices.
+// Each level becomes drawable once all of it is in. At most *budget bytes
+// are uploaded and the budget is reduced by as much. Returns whether
+// there is more to upload.
+static bool refine_load(AssetLoad* load, size_t* budget) {
+    Obj* obj = load->obj;
+    const Mesh* mesh = &load->mesh;
+    size_t stride = vertex_format_size(vertex_format);
+    size_t index_size = mesh->index_size;
+    // The copy target leaves the vertex array's buffer bindings alone.
+    while (load->refine_lod >= 0) {
+        const MeshLod* lod = &mesh->lods[load->refine_lod];
+        if (load->refine_verts < lod->n_verts) {
+            size_t n = lod->n_verts - load->refine_verts;
+            if (n > *budget / stride) {
+                n = *budget / stride;
+            }
+            if (n == 0) {
+                return true;
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, obj->vbo);
+            glBufferSubData(GL_COPY_WRITE_BUFFER,
+                            load->refine_verts * stride, n * stride,
+                            (const char*)load->verts.data +
+                            load->refine_verts * stride);
+            load->refine_verts += n;
+            *budget -= n * stride;
+        } else if (load->refine_indices < lod->n_indices) {
+            size_t n = lod->n_indices - load->refine_indices;
+            if (n > *budget / index_size) {
+                n = *budget / index_size;
+            }
+            if (n == 0) {
+                return true;
+            }
+            size_t offset = (lod->first_index + load->refine_indices) *
+                            index_size;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, obj->ibo);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, offset, n * index_size,
+                            (const char*)mesh->indices + offset);
+            load->refine_indices += n;
+            *budget -= n * index_size;
+        } else {
+            obj->first_lod = load->refine_lod;
+            load->refine_lod--;
+            load->refine_indices = 0;
+        }
+    }
+    release_load(load);
+    return false;
+}
 
-    Obj obj = {0};
-    obj_setup(&obj, shader, "res/grass.bmp", verts, 4, GL_TRIANGLE_STRIP);
-    return obj;
+// Refines finished loads until budget bytes are uploaded, and returns how
+// many still have levels of detail to upload.
+static int refine_loads(AssetLoad* loads, int n_loads, size_t budget) {
+    int n = 0;
+    for (int i = 0; i < n_loads; i++) {
+        if (loads[i].finished && loads[i].refine_lod >= 0 &&
+            refine_load(&loads[i], &budget)) {
+            n++;
+        }
+    }
+    return n;
 }
 
-static Obj new_obj(GLuint shader, const char* file_name) {
-    float* faces;
-    size_t n_faces;
-    if (!read_obj_file(file_name, &faces, &n_faces)) {
-        return (Obj){0};
+// Finishes every load that is done and returns how many there were.
+static int finish_loads(Materials* mats, AssetLoad* loads, int n_loads) {
+    int n = 0;
+    for (int i = 0; i < n_loads; i++) {
+        if (!loads[i].finished && atomic_load(&loads[i].done)) {
+            if (!finish_load(mats, &loads[i])) {
+                fprintf(stderr, "Could not load %s\n",
+                        loads[i].name ? loads[i].name : "built-in mesh");
+            }
+            n++;
+        }
     }
+    return n;
+}
 
-    Obj obj = {0};
-    obj_setup(&obj, shader, "res/wood.bmp", faces, n_faces * 3, GL_TRIANGLES);
+static double seconds_since(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) /
+           SDL_GetPerformanceFrequency();
+}
 
-    free(faces);
+// Picks the coarsest level of detail of sub whose error, scaled by the
+// model matrix and projected at the distance of the nearest point of its
+// bounding sphere, is below LOD_MAX_PIXEL_ERROR. Levels finer than
+// o->first_lod are not uploaded yet and never picked.
+static int select_lod(const Obj* o, const Submesh* sub, Affine model,
+                      Mat4 proj, Vec3 eye, int viewport_h) {
+    Vec3 center = affine_point_mul(model, vec3(sub->center[0],
+                                               sub->center[1],
+                                               sub->center[2]));
+    float scale = fmaxf(vec_len(vec3(model.xx, model.yx, model.zx)),
+                        fmaxf(vec_len(vec3(model.xy, model.yy, model.zy)),
+                              vec_len(vec3(model.xz, model.yz, model.zz))));
+    float dist = vec_len(vec_to(eye, center)) - sub->radius * scale;
+    if (dist <= 0) {
+        return o->first_lod;
+    }
+    // proj.yy is the cotangent of half the vertical field of view.
+    float pixels_per_unit = proj.yy * viewport_h * 0.5f / dist;
+    for (int lod = o->n_lods - 1; lod > o->first_lod; lod--) {
+        if (sub->lods[lod].error * scale * pixels_per_unit <=
+            LOD_MAX_PIXEL_ERROR) {
+            return lod;
+        }
+    }
+    return o->first_lod;
+}
 
-    return obj;
+// Chooses what to draw of each submesh of run: nothing if it is outside
+// the view frustum, its visible clusters at the finest level of detail,
+// and its whole range at the coarser ones. Stores the index ranges in
+// o->counts and o->offsets and returns how many there are; the number of
+// triangles in them is added to n_tris.
+static size_t obj_draw_ranges(const Obj* o, const DrawRun* run,
+                              Affine model, Affine view, Mat4 proj, Vec3 eye,
+                              int viewport_h, size_t* n_tris) {
+    Mat4 mv = mat_from_affine(affine_mul(view, model));
+    Mat4 mvp;
+    mat_mul_to(&mvp, &proj, &mv);
+    Frustum frustum;
+    frustum_from_mvp(&frustum, mvp.v);
+    Vec3 camera = affine_inv_point_mul(model, eye);
+    size_t index_size = o->index_type == GL_UNSIGNED_SHORT ? 2 : 4;
+    size_t n = 0;
+    for (uint32_t i = 0; i < run->n_submeshes; i++) {
+        const Submesh* sub = &o->submeshes[run->first_submesh + i];
+        if (!sphere_in_frustum(&frustum, sub->center, sub->radius)) {
+            continue;
+        }
+        int lod = select_lod(o, sub, model, proj, eye, viewport_h);
+        if (lod == 0 && sub->n_clusters) {
+            const Cluster* clusters = &o->clusters[sub->first_cluster];
+            size_t n_visible = cull_clusters(clusters, sub->n_clusters,
+                                             &frustum, camera.v, o->visible);
+            for (size_t j = 0; j < n_visible; j++) {
+                const Cluster* c = &clusters[o->visible[j]];
+                o->counts[n] = c->n_indices;
+                o->offsets[n] = (const char*)NULL +
+                                c->first_index * index_size;
+                *n_tris += c->n_indices / 3;
+                n++;
+            }
+        } else {
+            const MeshLod* range = &sub->lods[lod];
+            o->counts[n] = range->n_indices;
+            o->offsets[n] = (const char*)NULL +
+                            range->first_index * index_size;
+            *n_tris += range->n_indices / 3;
+            n++;
+        }
+    }
+    return n;
 }
 
-static void render_obj(const Obj* o, float color[4],
-                       float* model, float* view, float* proj) {
-    glUseProgram(o->shader);
-    glBindVertexArray(o->vao);
-    glBindTexture(GL_TEXTURE_2D, o->texture);
-    glUniform4fv(o->loc_color, 1, color);
-    glUniformMatrix4fv(o->loc_model, 1, GL_TRUE, model);
-    glUniformMatrix4fv(o->loc_view, 1, GL_TRUE, view);
-    glUniformMatrix4fv(o->loc_proj, 1, GL_TRUE, proj);
-    glDrawArrays(o->mode, 0, o->n_verts);
+static int compare_draws(const void* a, const void* b) {
+    const Draw* da = a;
+    const Draw* db = b;
+    if (da->run->material != db->run->material) {
+        return da->run->material < db->run->material ? -1 : 1;
+    }
+    // Keep the runs of an instance together, in instance order.
+    if (da->inst != db->inst) {
+        return da->inst < db->inst ? -1 : 1;
+    }
+    return da->run < db->run ? -1 : da->run > db->run;
+}
+
+// Makes a draw of every run of every instance, sorted by material.
+static Draw* build_draw_list(const Instance* insts, int n_insts,
+                             size_t* n_draws) {
+    size_t n = 0;
+    for (int i = 0; i < n_insts; i++) {
+        n += insts[i].obj->n_runs;
+    }
+    Draw* draws = malloc((n ? n : 1) * sizeof *draws);
+    if (!draws) {
+        return NULL;
+    }
+    n = 0;
+    for (int i = 0; i < n_insts; i++) {
+        for (size_t j = 0; j < insts[i].obj->n_runs; j++) {
+            draws[n++] = (Draw){&insts[i], &insts[i].obj->runs[j]};
+        }
+    }
+    qsort(draws, n, sizeof *draws, compare_draws);
+    *n_draws = n;
+    return draws;
+}
+
+// Draws the list from build_draw_list, binding each material once and each
+// instance once per material.
+static void render_draws(const Draw* draws, size_t n_draws,
+                         const Materials* mats, Affine view, Mat4 proj,
+                         Vec3 eye, int viewport_h) {
+    const DrawMaterial* material = NULL;
+    const Instance* inst = NULL;
+    for (size_t i = 0; i < n_draws; i++) {
+        const Draw* d = &draws[i];
+        const DrawMaterial* m = &mats->materials[d->run->material];
+        if (m != material) {
+            bind_material(m);
+            material = m;
+            inst = NULL;
+        }
+        const Obj* o = d->inst->obj;
+        if (d->inst != inst) {
+            inst = d->inst;
+            const Shader* s = m->shader;
+            glBindVertexArray(o->vao);
+            glUniformMatrix4fv(s->loc_model, 1, GL_FALSE,
+                               inst->model_col.v);
+            glUniform3fv(s->loc_pos_scale, 1, o->pos_scale);
+            glUniform3fv(s->loc_pos_offset, 1, o->pos_offset);
+        }
+        if (!o->n_indices) {
+            glDrawArrays(o->mode, 0, o->n_verts);
+            continue;
+        }
+        size_t n_tris = 0;
+        size_t n = obj_draw_ranges(o, d->run, inst->model, view, proj, eye,
+                                   viewport_h, &n_tris);
+        glMultiDrawElements(o->mode, o->counts, o->index_type, o->offsets,
+                            n);
+    }
+}
+
+// The inverse of the transform of a camera that is turned by yaw about z
+// and then tilted by pitch about its own x axis.
+static Affine camera_view(const Camera* camera) {
+    Transform t = {
+        .pos = camera->pos,
+        .rot = quat_mul(quat_from_rot(vec3(0, 0, camera->yaw)),
+                        quat_from_rot(vec3(camera->pitch, 0, 0))),
+        .scale = vec3(1, 1, 1),
+    };
+    return affine_inv(affine_from_transform(t));
+}
+
+// Prints how many triangles of each object are drawn after culling and
+// level of detail selection, from cameras walking in a circle around the
+// house and looking at it.
+static void print_cull_stats(const Instance* insts, const char** names,
+                             int n_insts, Mat4 proj, int viewport_h) {
+    int n_cameras = 8;
+    for (int i = 0; i < n_cameras; i++) {
+        float angle = 2 * PI * i / n_cameras;
+        Camera camera = {
+            .pos = vec3(12 * cosf(angle), 12 * sinf(angle), 1.7),
+            .pitch = PI/2,
+        };
+        camera.yaw = atan2f(camera.pos.x, -camera.pos.y);
+        Affine view = camera_view(&camera);
+        printf("camera (%5.1f, %5.1f, %3.1f):", camera.pos.x, camera.pos.y,
+               camera.pos.z);
+        for (int j = 0; j < n_insts; j++) {
+            const Obj* o = insts[j].obj;
+            size_t n_tris = 0;
+            for (size_t k = 0; k < o->n_runs; k++) {
+                obj_draw_ranges(o, &o->runs[k], insts[j].model, view, proj,
+                                camera.pos, viewport_h, &n_tris);
+            }
+            printf(" %s %zu/%u", names[j], n_tris, o->n_indices / 3);
+        }
+        printf(" triangles\n");
+    }
 }
 
 typedef struct {
@@ -427,26 +1289,141 @@ void destroy_window(Window* window) {
     SDL_Quit();
 }
 
-int main(void) {
+// With --cull-stats, prints cluster culling results for a scripted set of
+// camera positions and exits.
+//
+// With --stream or --stream=<MB>, the house and the ball are streamed from
+// their OBJ files with at most STREAM_MEM_CAP_MB, or MB, megabytes of CPU
+// memory each, instead of being read whole. A loader thread parses them
+// into vertex buffer windows that the main thread maps and unmaps, at most
+// UPLOAD_BYTES_PER_FRAME a frame together with refinement. They are then
+// drawn without an index buffer, clusters or levels of detail, so they
+// appear all at once and are never refined.
+//
+// Assets are read on loader threads while the main loop runs, and each
+// object appears once it has been uploaded, at its coarsest level of
+// detail until the finer ones are in. The time to the first frame and to
+// the last upload are printed.
+int main(int argc, char** argv) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    bool cull_stats = false;
+    size_t stream_cap = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cull-stats") == 0) {
+            cull_stats = true;
+        } else if (strncmp(argv[i], "--stream", 8) == 0) {
+            const char* mb = argv[i][8] == '=' ? argv[i] + 9 : "";
+            size_t cap = mb[0] ? strtoul(mb, NULL, 10) : STREAM_MEM_CAP_MB;
+            stream_cap = cap << 20;
+        }
+    }
+    linalg_init();
+    printf("Using %s linear algebra kernels\n", linalg->name);
     Window window;
     if (!create_window(&window, 852, 480, "Hello")) {
         return 1;
     }
 
     SDL_SetRelativeMouseMode(true);
-    GLuint shader_tex = load_shaders("shader_tex");
-    GLuint shader_plain = load_shaders("shader_plain");
+    Materials* materials = malloc(sizeof *materials);
+    if (!materials || !materials_setup(materials)) {
+        return 1;
+    }
     glViewport(0, 0, window.w, window.h);
     glClearColor(0.3, 0.5, 0.7, 1);
-    Mat4 view;
+    Affine view;
     float ratio_hw = (float)window.h / window.w;
     float clip_near = 0.01, clip_far = 300;
     float fov = 60;
     Mat4 proj = mat_from_persp(fov*PI/180, ratio_hw, clip_near, clip_far);
+    GLuint camera_ubo = camera_setup();
     glEnable(GL_DEPTH_TEST);
-    Obj house = new_obj(shader_tex, "house");
-    Obj ball = new_obj(shader_plain, "ball");
-    Obj rect = new_rect(shader_tex);
+    Pool* pool = pool_create(0);
+    // A job that waits for its own pool never finishes, so loads have
+    // their own threads and parse with the shared pool.
+    Pool* loader = pool_create(N_LOADERS);
+    Obj house = {0}, ball = {0}, rect = {0};
+    float ts = 16;
+    static float rect_verts[4 * MESH_STRIDE];
+    memcpy(rect_verts, (float[]){
+        -1, -1, 0, 0, 0, 0, 0, 1,
+        1, -1, 0, 1*ts, 0, 0, 0, 1,
+        -1, 1, 0, 0, 1*ts, 0, 0, 1,
+        1, 1, 0, 1*ts, 1*ts, 0, 0, 1,
+    }, sizeof rect_verts);
+    Material grass = {
+        .name = "grass",
+        .diffuse = {1, 1, 1},
+        .diffuse_map = "grass.bmp",
+    };
+    AssetLoad loads[] = {
+        {.name = "house", .obj = &house, .mode = GL_TRIANGLES, .pool = pool,
+         .stream_cap = stream_cap},
+        {.name = "ball", .obj = &ball, .mode = GL_TRIANGLES, .pool = pool,
+         .stream_cap = stream_cap},
+        {.obj = &rect, .mode = GL_TRIANGLE_STRIP,
+         .mesh = {.verts = rect_verts, .n_verts = 4},
+         .lib = &grass, .n_lib = 1},
+    };
+    int n_loads = sizeof loads / sizeof *loads;
+    mesh_compute_bounds(&loads[2].mesh);
+    for (int i = 0; i < n_loads; i++) {
+        atomic_init(&loads[i].done, false);
+        if (loads[i].stream_cap) {
+            loads[i].stream_lock = SDL_CreateMutex();
+            loads[i].stream_cond = SDL_CreateCond();
+            loads[i].stream_direct = !loader;
+            if (!loads[i].stream_lock || !loads[i].stream_cond) {
+                return 1;
+            }
+        }
+        if (loader) {
+            pool_submit(loader, run_load, &loads[i]);
+        } else {
+            run_load(&loads[i]);
+        }
+    }
+    int n_loading = n_loads;
+    int n_refining = 0;
+    Transform placements[] = {
+        {vec3(0, 0, 0), quat(1, 0, 0, 0), vec3(80, 80, 1)},
+        {vec3(0, 0, 0), quat(1, 0, 0, 0), vec3(1, 1, 1)},
+        {vec3(4, 0, 0), quat(1, 0, 0, 0), vec3(0.5, 0.5, 0.5)},
+    };
+    Instance instances[] = {{.obj = &rect}, {.obj = &house}, {.obj = &ball}};
+    int n_instances = sizeof instances / sizeof *instances;
+    for (int i = 0; i < n_instances; i++) {
+        instances[i].model = affine_from_transform(placements[i]);
+        Mat4 model = mat_from_affine(instances[i].model);
+        mat_col_to(&instances[i].model_col, &model);
+    }
+    size_t n_draws;
+    Draw* draws = build_draw_list(instances, n_instances, &n_draws);
+    if (!draws) {
+        return 1;
+    }
+    if (cull_stats) {
+        // Streamed loads need the main thread until they are done.
+        for (int n = 0; n < n_loads;) {
+            pump_streams(loads, n_loads, &(size_t){SIZE_MAX});
+            int finished = finish_loads(materials, loads, n_loads);
+            if (finished == 0) {
+                SDL_Delay(1);
+            }
+            n += finished;
+        }
+        if (loader) {
+            pool_destroy(loader);
+        }
+        refine_loads(loads, n_loads, SIZE_MAX);
+        const char* names[] = {"house", "ball"};
+        print_cull_stats(instances + 1, names, 2, proj, window.h);
+        if (pool) {
+            pool_destroy(pool);
+        }
+        destroy_window(&window);
+        return 0;
+    }
     Transform fly_camera = default_transform();
     fly_camera.pos.z = 1.6;
     fly_camera.rot = quat_from_rot(vec3(PI*0.2, 0, 0));
@@ -459,8 +1436,33 @@ int main(void) {
     camera.yaw = PI * 0.65f;
     float delta_time = 0;
     int prev_tick = 0;
+    bool first_frame = true;
     bool running = true;
     while (running) {
+        // Streamed meshes and levels of detail are uploaded a little every
+        // frame, so a big mesh never holds up drawing. Streams go first.
+        size_t upload_budget = UPLOAD_BYTES_PER_FRAME;
+        if (n_loading > 0) {
+            pump_streams(loads, n_loads, &upload_budget);
+            int n = finish_loads(materials, loads, n_loads);
+            if (n > 0) {
+                free(draws);
+                draws = build_draw_list(instances, n_instances, &n_draws);
+                if (!draws) {
+                    return 1;
+                }
+                n_loading -= n;
+                n_refining = 1;
+            }
+        }
+        if (n_refining > 0) {
+            n_refining = refine_loads(loads, n_loads, upload_budget);
+            if (n_loading == 0 && n_refining == 0) {
+                printf("Time to fully loaded: %.1f ms\n",
+                       seconds_since(start) * 1000);
+            }
+        }
+
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
@@ -651,34 +1653,26 @@ int main(void) {
             }
         }
 
-        Mat4 view_pos, view_rot;
+        Vec3 eye;
         if (flying) {
-            view_pos = mat_from_pos(vec_neg(fly_camera.pos));
-            view_rot = quat_to_mat(quat_neg(fly_camera.rot));
+            view = affine_inv(affine_from_transform(fly_camera));
+            eye = fly_camera.pos;
         } else {
-            view_pos = mat_from_pos(vec_neg(camera.pos));
-            view_rot = mat_mul(quat_to_mat(quat_from_rot(vec3(
-                    -camera.pitch, 0, 0
-                ))),
-                quat_to_mat(quat_from_rot(vec3(
-                    0, 0, -camera.yaw
-                )))
-            );
+            view = camera_view(&camera);
+            eye = camera.pos;
         }
-        view = mat_mul(view_rot, view_pos);
 
+        camera_upload(camera_ubo, view, proj);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        float white[] = {1, 1, 1, 1};
-        render_obj(&rect, white,
-                   mat_from_scale(vec3(80, 80, 1)).v, view.v, proj.v);
-        render_obj(&house, white, mat_identity().v, view.v, proj.v);
-        render_obj(&ball, white,
-                   mat_mul(mat_from_pos(vec3(4, 0, 0)),
-                           mat_from_scale(vec3(0.5, 0.5, 0.5))).v,
-                   view.v, proj.v);
+        render_draws(draws, n_draws, materials, view, proj, eye, window.h);
 
         SDL_GL_SwapWindow(window.window);
+        if (first_frame) {
+            printf("Time to first frame: %.1f ms\n",
+                   seconds_since(start) * 1000);
+            first_frame = false;
+        }
 
         if (recording && moviefile != NULL) {
             size_t bypp = 3;
@@ -698,6 +1692,13 @@ int main(void) {
         int fps = 60;
         SDL_Delay(prev_tick+1000/fps-ticks);
     }
+    cancel_streams(loads, n_loads);
+    if (loader) {
+        pool_destroy(loader);
+    }
+    if (pool) {
+        pool_destroy(pool);
+    }
     destroy_window(&window);
     return 0;
 }
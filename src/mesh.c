@@ -0,0 +1,364 @@
+#include "mesh.h"
+#include "meshcodec.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// 2: triangles and vertices are in vertex cache order.
+// 3: clusters after the index buffer.
+// 4: levels of detail.
+// 5: submeshes after the clusters.
+// 6: material library name.
+// 7: vertex and index buffers are encoded, see meshcodec.h.
+// 8: vertices in level of detail order, MeshLod.n_verts.
+#define MESH_FILE_VERSION 8
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t src_size;
+    int64_t src_mtime_ns;
+    // Floats per vertex; the attributes are always laid out as in Mesh.
+    uint32_t vertex_stride;
+    uint32_t n_verts;
+    uint32_t index_size;
+    uint32_t n_indices;
+    uint32_t n_clusters;
+    uint32_t n_lods;
+    uint32_t n_submeshes;
+    // Sizes of the encoded vertex and index buffers.
+    uint32_t vert_bytes;
+    uint32_t index_bytes;
+    float min[3], max[3];
+    MeshLod lods[MESH_MAX_LODS];
+    char material_lib[SUBMESH_NAME_SIZE];
+} MeshFileHeader;
+
+// Blobs start 16-byte aligned relative to the (page aligned) mapping.
+#define BLOB_ALIGN 16
+#define ALIGN_UP(x) (((x) + BLOB_ALIGN - 1) / BLOB_ALIGN * BLOB_ALIGN)
+
+void mesh_compute_bounds(Mesh* mesh) {
+    for (int i = 0; i < 3; i++) {
+        mesh->min[i] = FLT_MAX;
+        mesh->max[i] = -FLT_MAX;
+    }
+    for (size_t v = 0; v < mesh->n_verts; v++) {
+        const float* p = &mesh->verts[v * MESH_STRIDE];
+        for (int i = 0; i < 3; i++) {
+            if (p[i] < mesh->min[i]) {
+                mesh->min[i] = p[i];
+            }
+            if (p[i] > mesh->max[i]) {
+                mesh->max[i] = p[i];
+            }
+        }
+    }
+    if (mesh->n_verts == 0) {
+        memset(mesh->min, 0, sizeof mesh->min);
+        memset(mesh->max, 0, sizeof mesh->max);
+    }
+
+    for (size_t i = 0; i < mesh->n_submeshes; i++) {
+        Submesh* sub = &mesh->submeshes[i];
+        uint32_t first = sub->lods[0].first_index;
+        uint32_t end = first + sub->lods[0].n_indices;
+        for (int k = 0; k < 3; k++) {
+            sub->min[k] = first < end ? FLT_MAX : 0;
+            sub->max[k] = first < end ? -FLT_MAX : 0;
+        }
+        for (uint32_t j = first; j < end; j++) {
+            const float* p = &mesh->verts[mesh_index(mesh, j) * MESH_STRIDE];
+            for (int k = 0; k < 3; k++) {
+                sub->min[k] = p[k] < sub->min[k] ? p[k] : sub->min[k];
+                sub->max[k] = p[k] > sub->max[k] ? p[k] : sub->max[k];
+            }
+        }
+        float r_sq = 0;
+        for (int k = 0; k < 3; k++) {
+            sub->center[k] = (sub->min[k] + sub->max[k]) * 0.5f;
+        }
+        for (uint32_t j = first; j < end; j++) {
+            const float* p = &mesh->verts[mesh_index(mesh, j) * MESH_STRIDE];
+            float d[3] = {p[0] - sub->center[0], p[1] - sub->center[1],
+                          p[2] - sub->center[2]};
+            float dist_sq = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            r_sq = dist_sq > r_sq ? dist_sq : r_sq;
+        }
+        sub->radius = sqrtf(r_sq);
+    }
+}
+
+size_t vertex_format_size(VertexFormat format) {
+    return format == VERTEX_FLOAT ? MESH_STRIDE * sizeof (float) : 16;
+}
+
+// Rounds to the nearest half float, ties to even, like the conversion
+// instructions (F16C, NEON) do.
+static uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof x);
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+    if (abs >= 0x7f800000) {
+        // Infinity stays infinity, NaN stays (quiet) NaN.
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477ff000) {
+        // 65520 and up round to infinity.
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+        // Below 2^-14 the result is subnormal, in units of 2^-24.
+        if (abs < 0x33000000) {
+            return sign;
+        }
+        uint32_t mant = (abs & 0x7fffff) | 0x800000;
+        int shift = 126 - (int)(abs >> 23);
+        uint32_t h = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (h & 1))) {
+            h++;
+        }
+        return sign | h;
+    }
+    // Rebias the exponent from 127 to 15 and drop 13 mantissa bits. A
+    // carry out of the mantissa correctly bumps the exponent.
+    uint32_t h = (abs - 0x38000000) >> 13;
+    uint32_t rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) {
+        h++;
+    }
+    return sign | h;
+}
+
+static uint32_t pack_snorm10(float v) {
+    v = v < -1 ? -1 : v > 1 ? 1 : v;
+    return (uint32_t)lrintf(v * 511) & 0x3ff;
+}
+
+static uint32_t pack_normal(const float* n) {
+    float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    float inv = len > 0 ? 1 / len : 0;
+    return pack_snorm10(n[0] * inv) | pack_snorm10(n[1] * inv) << 10 |
+           pack_snorm10(n[2] * inv) << 20;
+}
+
+void mesh_pack_vertices(const Mesh* mesh, VertexFormat format, void* out,
+                        float scale[3], float offset[3]) {
+    for (int i = 0; i < 3; i++) {
+        switch (format) {
+        case VERTEX_FLOAT:
+            scale[i] = 1;
+            offset[i] = 0;
+            break;
+        case VERTEX_HALF:
+            scale[i] = 1;
+            offset[i] = (mesh->min[i] + mesh->max[i]) * 0.5f;
+            break;
+        case VERTEX_UNORM16:
+            scale[i] = mesh->max[i] - mesh->min[i];
+            offset[i] = mesh->min[i];
+            break;
+        }
+    }
+    if (format == VERTEX_FLOAT) {
+        memcpy(out, mesh->verts, mesh->n_verts * MESH_STRIDE * sizeof (float));
+        return;
+    }
+    unsigned char* dst = out;
+    for (size_t v = 0; v < mesh->n_verts; v++, dst += 16) {
+        const float* src = &mesh->verts[v * MESH_STRIDE];
+        uint16_t pos[4] = {0};
+        for (int i = 0; i < 3; i++) {
+            if (format == VERTEX_HALF) {
+                pos[i] = float_to_half(src[i] - offset[i]);
+            } else if (scale[i] > 0) {
+                float t = (src[i] - offset[i]) / scale[i];
+                pos[i] = lrintf(t < 0 ? 0 : t > 1 ? 65535 : t * 65535);
+            }
+        }
+        uint16_t tex[2] = {float_to_half(src[3]), float_to_half(src[4])};
+        uint32_t norm = pack_normal(&src[5]);
+        memcpy(dst, pos, 8);
+        memcpy(dst + 8, tex, 4);
+        memcpy(dst + 12, &norm, 4);
+    }
+}
+
+static bool lod_in_range(const MeshLod* lod, size_t n_indices) {
+    return (uint64_t)lod->first_index + lod->n_indices <= n_indices;
+}
+
+static bool cluster_in_range(const Cluster* c, size_t n_indices) {
+    return (uint64_t)c->first_index + c->n_indices <= n_indices;
+}
+
+// Whether the n indices from first all refer to one of the first n_verts
+// vertices.
+static bool indices_below(const Mesh* mesh, size_t first, size_t n,
+                          size_t n_verts) {
+    for (size_t i = first; i < first + n; i++) {
+        if (mesh_index(mesh, i) >= n_verts) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_mesh_file(Arena* arena, MappedFile* file, const char* path,
+                    const char* src_path, Mesh* mesh) {
+    if (!map_file(file, path)) {
+        return false;
+    }
+    MeshFileHeader h;
+    if (file->len < sizeof h) {
+        unmap_file(file);
+        return false;
+    }
+    memcpy(&h, file->data, sizeof h);
+    size_t vert_offset = ALIGN_UP(sizeof h);
+    size_t index_offset = ALIGN_UP(vert_offset + h.vert_bytes);
+    size_t cluster_offset = ALIGN_UP(index_offset + h.index_bytes);
+    size_t cluster_bytes = (size_t)h.n_clusters * sizeof (Cluster);
+    size_t submesh_offset = ALIGN_UP(cluster_offset + cluster_bytes);
+    size_t submesh_bytes = (size_t)h.n_submeshes * sizeof (Submesh);
+    if (memcmp(h.magic, "MESH", 4) != 0 || h.version != MESH_FILE_VERSION ||
+        !source_matches(src_path, &(FileInfo){h.src_size, h.src_mtime_ns}) ||
+        h.vertex_stride != MESH_STRIDE ||
+        (h.index_size != 2 && h.index_size != 4) ||
+        h.n_lods > MESH_MAX_LODS ||
+        file->len < submesh_offset + submesh_bytes) {
+        unmap_file(file);
+        return false;
+    }
+    *mesh = (Mesh){
+        .verts = arena_alloc(arena, ((size_t)h.n_verts * MESH_STRIDE + 1) *
+                                    sizeof (float)),
+        .n_verts = h.n_verts,
+        .indices = arena_alloc(arena, (size_t)h.n_indices * h.index_size + 1),
+        .n_indices = h.n_indices,
+        .index_size = h.index_size,
+        .clusters = h.n_clusters ? (Cluster*)(file->data + cluster_offset)
+                                 : NULL,
+        .n_clusters = h.n_clusters,
+        .n_lods = h.n_lods,
+        .submeshes = h.n_submeshes
+            ? (Submesh*)(file->data + submesh_offset) : NULL,
+        .n_submeshes = h.n_submeshes,
+    };
+    memcpy(mesh->min, h.min, sizeof h.min);
+    memcpy(mesh->max, h.max, sizeof h.max);
+    memcpy(mesh->lods, h.lods, sizeof h.lods);
+    memcpy(mesh->material_lib, h.material_lib, sizeof h.material_lib);
+    mesh->material_lib[sizeof mesh->material_lib - 1] = '\0';
+    bool ok = mesh->verts && mesh->indices &&
+              decode_vertex_buffer(arena, mesh->verts, mesh->n_verts,
+                                   MESH_STRIDE * sizeof (float),
+                                   file->data + vert_offset, h.vert_bytes) &&
+              decode_index_buffer(arena, mesh->indices, mesh->n_indices,
+                                  mesh->index_size,
+                                  file->data + index_offset, h.index_bytes);
+    // Ranges and indices are used for drawing, so a bad one must not get
+    // through. refine_load also relies on each level only using its
+    // prefix of the vertices.
+    ok = ok && indices_below(mesh, 0, mesh->n_indices, mesh->n_verts);
+    for (int i = 0; i < mesh->n_lods; i++) {
+        const MeshLod* lod = &mesh->lods[i];
+        ok = ok && lod_in_range(lod, mesh->n_indices) &&
+             lod->n_verts <= mesh->n_verts &&
+             indices_below(mesh, lod->first_index, lod->n_indices,
+                           lod->n_verts);
+    }
+    for (size_t i = 0; i < mesh->n_clusters; i++) {
+        ok = ok && cluster_in_range(&mesh->clusters[i], mesh->n_indices);
+    }
+    for (size_t i = 0; i < mesh->n_submeshes; i++) {
+        const Submesh* sub = &mesh->submeshes[i];
+        for (int j = 0; j < (mesh->n_lods ? mesh->n_lods : 1); j++) {
+            ok = ok && lod_in_range(&sub->lods[j], mesh->n_indices);
+        }
+        ok = ok && (uint64_t)sub->first_cluster + sub->n_clusters <=
+                   mesh->n_clusters;
+    }
+    if (!ok) {
+        unmap_file(file);
+        return false;
+    }
+    return true;
+}
+
+static bool write_padded(FILE* f, const void* data, size_t len) {
+    static const char zeros[BLOB_ALIGN] = {0};
+    return fwrite(data, 1, len, f) == len &&
+           fwrite(zeros, 1, ALIGN_UP(len) - len, f) == ALIGN_UP(len) - len;
+}
+
+bool write_mesh_file(const char* path, const char* src_path,
+                     const Mesh* mesh) {
+    FileInfo src;
+    if (!stat_file(src_path, &src) || mesh->n_verts > UINT32_MAX ||
+        mesh->n_indices > UINT32_MAX || mesh->n_clusters > UINT32_MAX ||
+        mesh->n_submeshes > UINT32_MAX) {
+        return false;
+    }
+    Arena arena = {0};
+    void* verts;
+    void* indices;
+    size_t vert_bytes, index_bytes;
+    if (!encode_vertex_buffer(&arena, mesh->verts, mesh->n_verts,
+                              MESH_STRIDE * sizeof (float), &verts,
+                              &vert_bytes) ||
+        !encode_index_buffer(&arena, mesh->indices, mesh->n_indices,
+                             mesh->index_size, &indices, &index_bytes) ||
+        vert_bytes > UINT32_MAX || index_bytes > UINT32_MAX) {
+        arena_free(&arena);
+        return false;
+    }
+    MeshFileHeader h = {
+        .magic = {'M', 'E', 'S', 'H'},
+        .version = MESH_FILE_VERSION,
+        .src_size = src.size,
+        .src_mtime_ns = src.mtime_ns,
+        .vertex_stride = MESH_STRIDE,
+        .n_verts = mesh->n_verts,
+        .index_size = mesh->index_size,
+        .n_indices = mesh->n_indices,
+        .n_clusters = mesh->n_clusters,
+        .n_lods = mesh->n_lods,
+        .n_submeshes = mesh->n_submeshes,
+        .vert_bytes = vert_bytes,
+        .index_bytes = index_bytes,
+    };
+    memcpy(h.min, mesh->min, sizeof h.min);
+    memcpy(h.max, mesh->max, sizeof h.max);
+    memcpy(h.lods, mesh->lods, sizeof h.lods);
+    memcpy(h.material_lib, mesh->material_lib, sizeof h.material_lib);
+
+    // Write to a temporary name and rename, so that a reader never maps a
+    // half-written file.
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path);
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) {
+        arena_free(&arena);
+        return false;
+    }
+    bool ok = write_padded(f, &h, sizeof h) &&
+              write_padded(f, verts, vert_bytes) &&
+              write_padded(f, indices, index_bytes) &&
+              write_padded(f, mesh->clusters,
+                           mesh->n_clusters * sizeof (Cluster)) &&
+              write_padded(f, mesh->submeshes,
+                           mesh->n_submeshes * sizeof (Submesh));
+    ok = fclose(f) == 0 && ok;
+    arena_free(&arena);
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
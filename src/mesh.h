@@ -0,0 +1,142 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "arena.h"
+#include "file.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Interleaved vertex: position (3), texture coordinate (2), normal (3).
+#define MESH_STRIDE 8
+
+// A run of triangles in the index buffer that are close together and face
+// roughly the same way, so that they can be culled as a group.
+typedef struct {
+    uint32_t first_index;
+    uint32_t n_indices;
+    // Bounding sphere.
+    float center[3];
+    float radius;
+    // Normal cone: cone_cutoff is the sine of the largest angle between
+    // cone_axis and a triangle normal, or 1 if the normals are too spread
+    // out for the cluster to ever be entirely back-facing.
+    float cone_axis[3];
+    float cone_cutoff;
+} Cluster;
+
+#define MESH_MAX_LODS 4
+
+// A level of detail: a range of the index buffer that draws the whole mesh.
+typedef struct {
+    uint32_t first_index;
+    uint32_t n_indices;
+    // Bound on how far the surface is from the full detail one, in model
+    // units.
+    float error;
+    // The level only uses the first n_verts vertices, see build_lods. Only
+    // set in Mesh.lods.
+    uint32_t n_verts;
+} MeshLod;
+
+#define SUBMESH_NAME_SIZE 64
+
+// A part of a mesh that was a separate object or used a separate material
+// in the source file. Each level of detail draws the submeshes as
+// consecutive index ranges, in the same order.
+typedef struct {
+    // Object and material names, truncated and NUL-terminated. Empty if
+    // the source file does not name them.
+    char name[SUBMESH_NAME_SIZE];
+    char material[SUBMESH_NAME_SIZE];
+    // The submesh's index range in each level of detail of the mesh. Only
+    // lods[0] is set if the mesh has no levels of detail.
+    MeshLod lods[MESH_MAX_LODS];
+    // The clusters of the submesh, see build_clusters.
+    uint32_t first_cluster;
+    uint32_t n_clusters;
+    float min[3], max[3];
+    // Bounding sphere.
+    float center[3];
+    float radius;
+} Submesh;
+
+// Indexed triangle list.
+typedef struct {
+    float* verts;
+    size_t n_verts;
+    // uint16_t if index_size is 2, uint32_t if it is 4.
+    void* indices;
+    size_t n_indices;
+    size_t index_size;
+    // Axis-aligned bounding box of the positions.
+    float min[3], max[3];
+    // Optional partition of the first level of detail, see build_clusters.
+    Cluster* clusters;
+    size_t n_clusters;
+    // Levels of detail, finest first, see build_lods. Without them the
+    // whole index buffer is the only level.
+    MeshLod lods[MESH_MAX_LODS];
+    int n_lods;
+    // Parts of the mesh, in index buffer order within each level of
+    // detail.
+    Submesh* submeshes;
+    size_t n_submeshes;
+    // MTL file with the submeshes' materials, relative to the mesh file.
+    // Empty if there is none.
+    char material_lib[SUBMESH_NAME_SIZE];
+} Mesh;
+
+static inline uint32_t mesh_index(const Mesh* mesh, size_t i) {
+    if (mesh->index_size == 2) {
+        return ((const uint16_t*)mesh->indices)[i];
+    }
+    return ((const uint32_t*)mesh->indices)[i];
+}
+
+static inline void mesh_set_index(Mesh* mesh, size_t i, uint32_t v) {
+    if (mesh->index_size == 2) {
+        ((uint16_t*)mesh->indices)[i] = v;
+    } else {
+        ((uint32_t*)mesh->indices)[i] = v;
+    }
+}
+
+// Computes the bounds of the mesh and of its submeshes.
+void mesh_compute_bounds(Mesh* mesh);
+
+// GPU vertex layouts. The compressed ones are 16 bytes per vertex instead
+// of 32: position (3 components and 2 bytes of padding), UV as two half
+// floats, and the normal as a signed normalized GL_INT_2_10_10_10_REV.
+typedef enum {
+    // Floats, laid out as in Mesh.
+    VERTEX_FLOAT,
+    // Positions as half floats relative to the center of the bounds.
+    VERTEX_HALF,
+    // Positions as normalized 16-bit integers spanning the bounds.
+    VERTEX_UNORM16,
+} VertexFormat;
+
+size_t vertex_format_size(VertexFormat format);
+
+// Converts the vertices of mesh to format, writing n_verts *
+// vertex_format_size(format) bytes to out. The shader gets the original
+// position back as offset + scale * attribute.
+void mesh_pack_vertices(const Mesh* mesh, VertexFormat format, void* out,
+                        float scale[3], float offset[3]);
+
+// Cooked meshes are a header followed by the encoded vertex and index
+// buffers (see meshcodec.h) and the raw clusters and submeshes. The header
+// records the size and modification time of the source file so that stale
+// files are ignored.
+
+// Maps the cooked mesh at path, decodes its vertices and indices into
+// memory from arena, and points the rest of mesh into the mapping. Fails
+// if the file is missing, malformed, or out of date with src_path (see
+// source_matches). On success, file must be released with unmap_file.
+bool load_mesh_file(Arena* arena, MappedFile* file, const char* path,
+                    const char* src_path, Mesh* mesh);
+bool write_mesh_file(const char* path, const char* src_path,
+                     const Mesh* mesh);
+
+#endif // MESH_H
@@ -0,0 +1,355 @@
+#include "meshcodec.h"
+#include <stdint.h>
+#include <string.h>
+
+// LZ77 in the style of LZ4: each sequence is a token byte with the
+// literal count in the high nibble and the match length minus
+// LZ_MIN_MATCH in the low nibble, counts of 15 continued by bytes that are
+// added until one is below 255, the literals, and a 16-bit little-endian
+// match offset. The last sequence has only literals.
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xffff
+#define LZ_HASH_BITS 16
+
+// Vertices are coded in chunks of this many, so that the decoder only
+// needs scratch space for one chunk.
+#define VERTEX_CHUNK 2048
+
+static size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t* put_count(uint8_t* p, size_t n) {
+    for (; n >= 255; n -= 255) {
+        *p++ = 255;
+    }
+    *p++ = n;
+    return p;
+}
+
+static uint8_t* put_sequence(uint8_t* p, const uint8_t* lit, size_t n_lit,
+                             size_t offset, size_t match_len) {
+    size_t m = match_len ? match_len - LZ_MIN_MATCH : 0;
+    *p++ = (n_lit < 15 ? n_lit : 15) << 4 | (m < 15 ? m : 15);
+    if (n_lit >= 15) {
+        p = put_count(p, n_lit - 15);
+    }
+    memcpy(p, lit, n_lit);
+    p += n_lit;
+    if (match_len) {
+        *p++ = offset;
+        *p++ = offset >> 8;
+        if (m >= 15) {
+            p = put_count(p, m - 15);
+        }
+    }
+    return p;
+}
+
+#define LZ_TABLE_BYTES (sizeof (uint32_t) << LZ_HASH_BITS)
+
+// Greedy parse with one candidate per hash of the next four bytes. dst
+// must have room for lz_bound(n) bytes. table is LZ_TABLE_BYTES of
+// scratch space, which is cleared here, so callers can reuse it.
+static size_t lz_compress(uint32_t* table, const uint8_t* src, size_t n,
+                          uint8_t* dst) {
+    memset(table, 0, LZ_TABLE_BYTES);
+    uint8_t* p = dst;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t v = read32(src + i);
+        uint32_t* slot = &table[lz_hash(v)];
+        size_t cand = *slot;
+        *slot = i;
+        if (cand >= i || i - cand > LZ_MAX_OFFSET ||
+            read32(src + cand) != v) {
+            i++;
+            continue;
+        }
+        size_t len = LZ_MIN_MATCH;
+        while (i + len < n && src[cand + len] == src[i + len]) {
+            len++;
+        }
+        p = put_sequence(p, src + anchor, i - anchor, i - cand, len);
+        i += len;
+        anchor = i;
+    }
+    p = put_sequence(p, src + anchor, n - anchor, 0, 0);
+    return p - dst;
+}
+
+static bool get_count(const uint8_t** p, const uint8_t* end, size_t* n) {
+    uint8_t b;
+    do {
+        if (*p == end) {
+            return false;
+        }
+        b = *(*p)++;
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+// Decompresses exactly dst_len bytes.
+static bool lz_decompress(const uint8_t* src, size_t n, uint8_t* dst,
+                          size_t dst_len) {
+    const uint8_t* p = src;
+    const uint8_t* end = src + n;
+    uint8_t* op = dst;
+    uint8_t* op_end = dst + dst_len;
+    while (p < end) {
+        unsigned token = *p++;
+        size_t n_lit = token >> 4;
+        if (n_lit == 15 && !get_count(&p, end, &n_lit)) {
+            return false;
+        }
+        if (n_lit > (size_t)(end - p) || n_lit > (size_t)(op_end - op)) {
+            return false;
+        }
+        // Short literals and matches are copied 16 bytes at a time when
+        // there is room, which is faster than an exact copy. The extra
+        // bytes are overwritten by what follows.
+        if (n_lit <= 16 && end - p >= 16 && op_end - op >= 16) {
+            memcpy(op, p, 16);
+        } else {
+            memcpy(op, p, n_lit);
+        }
+        op += n_lit;
+        p += n_lit;
+        if (p == end) {
+            break;
+        }
+        if (end - p < 2) {
+            return false;
+        }
+        size_t offset = p[0] | p[1] << 8;
+        p += 2;
+        size_t len = token & 15;
+        if (len == 15 && !get_count(&p, end, &len)) {
+            return false;
+        }
+        len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) ||
+            len > (size_t)(op_end - op)) {
+            return false;
+        }
+        if (offset >= 16 && len <= 16 && op_end - op >= 16) {
+            memcpy(op, op - offset, 16);
+            op += len;
+            continue;
+        }
+        // An overlapping match repeats the last offset bytes. Any multiple
+        // of offset is also a period, so the copies can double in size.
+        for (size_t step = offset; len > 0; step *= 2) {
+            size_t c = len < step ? len : step;
+            memcpy(op, op - step, c);
+            op += c;
+            len -= c;
+        }
+    }
+    return op == op_end;
+}
+
+static uint32_t zigzag(uint32_t d) {
+    return d << 1 ^ (uint32_t)-(int32_t)(d >> 31);
+}
+
+static uint32_t unzigzag(uint32_t z) {
+    return z >> 1 ^ -(z & 1);
+}
+
+// Compresses raw into a buffer that starts with the raw length.
+static bool pack(Arena* arena, const uint8_t* raw, size_t raw_len,
+                 void** out, size_t* out_len) {
+    if (raw_len > UINT32_MAX) {
+        return false;
+    }
+    uint8_t* buf = arena_alloc(arena, 4 + lz_bound(raw_len));
+    uint32_t* table = arena_alloc(arena, LZ_TABLE_BYTES);
+    if (!buf || !table) {
+        return false;
+    }
+    uint32_t len32 = raw_len;
+    memcpy(buf, &len32, 4);
+    size_t n = lz_compress(table, raw, raw_len, buf + 4);
+    if (n == 0) {
+        return false;
+    }
+    *out = buf;
+    *out_len = 4 + n;
+    return true;
+}
+
+// Decompresses a buffer made by pack into memory from arena.
+static uint8_t* unpack(Arena* arena, const void* in, size_t len,
+                       size_t* raw_len) {
+    if (len < 4) {
+        return NULL;
+    }
+    uint32_t len32;
+    memcpy(&len32, in, 4);
+    uint8_t* raw = arena_alloc(arena, len32 ? len32 : 1);
+    if (!raw || !lz_decompress((const uint8_t*)in + 4, len - 4, raw, len32)) {
+        return NULL;
+    }
+    *raw_len = len32;
+    return raw;
+}
+
+bool encode_vertex_buffer(Arena* arena, const void* verts, size_t n_verts,
+                          size_t vertex_size, void** out, size_t* out_len) {
+    size_t n_words = vertex_size / 4;
+    size_t chunk_bytes = VERTEX_CHUNK * vertex_size;
+    size_t n_chunks = (n_verts + VERTEX_CHUNK - 1) / VERTEX_CHUNK;
+    uint8_t* planes = arena_alloc(arena, chunk_bytes + 1);
+    uint8_t* buf = arena_alloc(arena, n_chunks * (4 + lz_bound(chunk_bytes)) +
+                                      1);
+    // One hash table for all chunks.
+    uint32_t* table = arena_alloc(arena, LZ_TABLE_BYTES);
+    if (vertex_size % 4 != 0 || !planes || !buf || !table) {
+        return false;
+    }
+    const uint8_t* src = verts;
+    uint8_t* p = buf;
+    for (size_t v0 = 0; v0 < n_verts; v0 += VERTEX_CHUNK) {
+        size_t n = n_verts - v0 < VERTEX_CHUNK ? n_verts - v0 : VERTEX_CHUNK;
+        for (size_t w = 0; w < n_words; w++) {
+            uint8_t* plane = planes + w * 4 * n;
+            for (size_t i = 0; i < n; i++) {
+                size_t v = v0 + i;
+                uint32_t x, prev = 0;
+                memcpy(&x, src + v * vertex_size + w * 4, 4);
+                if (v > 0) {
+                    memcpy(&prev, src + (v - 1) * vertex_size + w * 4, 4);
+                }
+                uint32_t z = zigzag(x - prev);
+                for (int b = 0; b < 4; b++) {
+                    plane[b * n + i] = z >> (b * 8);
+                }
+            }
+        }
+        size_t len = lz_compress(table, planes, n * vertex_size, p + 4);
+        if (len == 0) {
+            return false;
+        }
+        uint32_t len32 = len;
+        memcpy(p, &len32, 4);
+        p += 4 + len;
+    }
+    *out = buf;
+    *out_len = p - buf;
+    return true;
+}
+
+bool decode_vertex_buffer(Arena* arena, void* out, size_t n_verts,
+                          size_t vertex_size, const void* in, size_t len) {
+    size_t n_words = vertex_size / 4;
+    uint8_t* planes = arena_alloc(arena, VERTEX_CHUNK * vertex_size + 1);
+    uint32_t* prev = arena_alloc(arena, (n_words + 1) * sizeof *prev);
+    if (!planes || !prev || vertex_size % 4 != 0) {
+        return false;
+    }
+    memset(prev, 0, n_words * sizeof *prev);
+    const uint8_t* p = in;
+    const uint8_t* end = p + len;
+    uint32_t* dst = out;
+    for (size_t v0 = 0; v0 < n_verts; v0 += VERTEX_CHUNK) {
+        size_t n = n_verts - v0 < VERTEX_CHUNK ? n_verts - v0 : VERTEX_CHUNK;
+        uint32_t chunk_len;
+        if (end - p < 4) {
+            return false;
+        }
+        memcpy(&chunk_len, p, 4);
+        p += 4;
+        if (chunk_len > (size_t)(end - p) ||
+            !lz_decompress(p, chunk_len, planes, n * vertex_size)) {
+            return false;
+        }
+        p += chunk_len;
+        for (size_t w = 0; w < n_words; w++) {
+            const uint8_t* p0 = planes + w * 4 * n;
+            const uint8_t* p1 = p0 + n;
+            const uint8_t* p2 = p1 + n;
+            const uint8_t* p3 = p2 + n;
+            uint32_t* d = dst + v0 * n_words + w;
+            uint32_t x = prev[w];
+            for (size_t i = 0; i < n; i++) {
+                x += unzigzag(p0[i] | p1[i] << 8 | (uint32_t)p2[i] << 16 |
+                              (uint32_t)p3[i] << 24);
+                d[i * n_words] = x;
+            }
+            prev[w] = x;
+        }
+    }
+    return p == end;
+}
+
+bool encode_index_buffer(Arena* arena, const void* indices, size_t n,
+                         size_t index_size, void** out, size_t* out_len) {
+    uint8_t* raw = arena_alloc(arena, n * 5 + 1);
+    if (!raw || (index_size != 2 && index_size != 4)) {
+        return false;
+    }
+    uint8_t* p = raw;
+    uint32_t prev = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t x;
+        if (index_size == 2) {
+            x = ((const uint16_t*)indices)[i];
+        } else {
+            x = ((const uint32_t*)indices)[i];
+        }
+        uint32_t z = zigzag(x - prev);
+        prev = x;
+        for (; z >= 0x80; z >>= 7) {
+            *p++ = z | 0x80;
+        }
+        *p++ = z;
+    }
+    return pack(arena, raw, p - raw, out, out_len);
+}
+
+bool decode_index_buffer(Arena* arena, void* out, size_t n,
+                         size_t index_size, const void* in, size_t len) {
+    size_t raw_len;
+    const uint8_t* p = unpack(arena, in, len, &raw_len);
+    if (!p || (index_size != 2 && index_size != 4)) {
+        return false;
+    }
+    const uint8_t* end = p + raw_len;
+    uint32_t x = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t z = 0;
+        for (int shift = 0;; shift += 7) {
+            if (p == end || shift > 28) {
+                return false;
+            }
+            uint8_t b = *p++;
+            z |= (uint32_t)(b & 0x7f) << shift;
+            if (b < 0x80) {
+                break;
+            }
+        }
+        x += unzigzag(z);
+        if (index_size == 2) {
+            if (x > UINT16_MAX) {
+                return false;
+            }
+            ((uint16_t*)out)[i] = x;
+        } else {
+            ((uint32_t*)out)[i] = x;
+        }
+    }
+    return p == end;
+}
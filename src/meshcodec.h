@@ -0,0 +1,42 @@
+#ifndef MESHCODEC_H
+#define MESHCODEC_H
+
+#include "arena.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Compact encodings of vertex and index buffers for cooked meshes. Both
+// turn the buffer into a stream of mostly small bytes and then compress it
+// with a byte-oriented LZ77 coder whose decoder only copies bytes.
+//
+// Vertices: every 32-bit word is replaced by the zigzag-coded difference
+// from the same word of the previous vertex, and the bytes are split into
+// planes, so that all first bytes of a word come first, then all second
+// bytes and so on. Neighbouring vertices are similar after
+// optimize_vertex_fetch, so the high planes are mostly zeros. Chunks of
+// 2048 vertices are compressed separately, each after its length.
+//
+// Indices: every index is replaced by the zigzag-coded difference from the
+// previous one, written as a little-endian base-128 varint. Indices in
+// vertex cache order are close together, so most take one byte.
+//
+// Encoded indices start with their length before compression. Decoders
+// check every length and offset, so a damaged buffer fails instead of
+// writing out of bounds.
+
+// Encodes n_verts vertices of vertex_size bytes, a multiple of 4. The
+// result is allocated from arena.
+bool encode_vertex_buffer(Arena* arena, const void* verts, size_t n_verts,
+                          size_t vertex_size, void** out, size_t* out_len);
+// Decodes exactly n_verts vertices into out. Scratch memory comes from
+// arena.
+bool decode_vertex_buffer(Arena* arena, void* out, size_t n_verts,
+                          size_t vertex_size, const void* in, size_t len);
+
+// Encodes n indices of index_size bytes, 2 or 4.
+bool encode_index_buffer(Arena* arena, const void* indices, size_t n,
+                         size_t index_size, void** out, size_t* out_len);
+bool decode_index_buffer(Arena* arena, void* out, size_t n,
+                         size_t index_size, const void* in, size_t len);
+
+#endif // MESHCODEC_H
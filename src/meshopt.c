@@ -0,0 +1,548 @@
+#include "meshopt.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Simulated LRU cache size and score weights from Forsyth's article.
+#define CACHE_SIZE 32
+#define LAST_TRI_SCORE 0.75f
+#define CACHE_DECAY_POWER 1.5f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+// Cluster limits, the usual sizes for mesh shader meshlets.
+#define CLUSTER_MAX_VERTS 64
+#define CLUSTER_MAX_TRIS 124
+
+float mesh_acmr(const Mesh* mesh, int cache_size) {
+    if (mesh->n_indices < 3) {
+        return 0;
+    }
+    uint32_t cache[64];
+    if (cache_size > 64) {
+        cache_size = 64;
+    }
+    int n_cached = 0, next = 0;
+    size_t misses = 0;
+    for (size_t i = 0; i < mesh->n_indices; i++) {
+        uint32_t v = mesh_index(mesh, i);
+        bool hit = false;
+        for (int j = 0; j < n_cached; j++) {
+            if (cache[j] == v) {
+                hit = true;
+                break;
+            }
+        }
+        if (!hit) {
+            misses++;
+            cache[next] = v;
+            next = (next + 1) % cache_size;
+            if (n_cached < cache_size) {
+                n_cached++;
+            }
+        }
+    }
+    return (float)misses / (mesh->n_indices / 3);
+}
+
+static float vertex_score(int cache_pos, uint32_t n_live) {
+    if (n_live == 0) {
+        return -1;
+    }
+    float score = 0;
+    if (cache_pos >= 0) {
+        if (cache_pos < 3) {
+            score = LAST_TRI_SCORE;
+        } else {
+            float s = 1 - (float)(cache_pos - 3) / (CACHE_SIZE - 3);
+            score = powf(s, CACHE_DECAY_POWER);
+        }
+    }
+    return score + VALENCE_BOOST_SCALE * powf(n_live, -VALENCE_BOOST_POWER);
+}
+
+bool optimize_vertex_cache(Arena* arena, Mesh* mesh) {
+    size_t n_tris = mesh->n_indices / 3;
+    size_t n_verts = mesh->n_verts;
+    if (n_tris == 0) {
+        return true;
+    }
+    // Triangles around each vertex, as offsets into one array. n_live[v]
+    // counts the ones not emitted yet, which are kept at the front.
+    uint32_t* first_tri = arena_alloc(arena,
+                                      (n_verts + 1) * sizeof (uint32_t));
+    uint32_t* n_live = arena_alloc(arena, n_verts * sizeof (uint32_t));
+    uint32_t* vert_tris = arena_alloc(arena, n_tris * 3 * sizeof (uint32_t));
+    float* vert_score = arena_alloc(arena, n_verts * sizeof (float));
+    int* cache_pos = arena_alloc(arena, n_verts * sizeof (int));
+    float* tri_score = arena_alloc(arena, n_tris * sizeof (float));
+    bool* emitted = arena_alloc(arena, n_tris * sizeof (bool));
+    uint32_t* out = arena_alloc(arena, n_tris * 3 * sizeof (uint32_t));
+    if (!first_tri || !n_live || !vert_tris || !vert_score || !cache_pos ||
+        !tri_score || !emitted || !out) {
+        return false;
+    }
+    memset(n_live, 0, n_verts * sizeof (uint32_t));
+    for (size_t i = 0; i < n_tris * 3; i++) {
+        n_live[mesh_index(mesh, i)]++;
+    }
+    first_tri[0] = 0;
+    for (size_t v = 0; v < n_verts; v++) {
+        first_tri[v + 1] = first_tri[v] + n_live[v];
+        n_live[v] = 0;
+        cache_pos[v] = -1;
+    }
+    for (size_t t = 0; t < n_tris; t++) {
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = mesh_index(mesh, t * 3 + k);
+            vert_tris[first_tri[v] + n_live[v]++] = t;
+        }
+    }
+    for (size_t v = 0; v < n_verts; v++) {
+        vert_score[v] = vertex_score(-1, n_live[v]);
+    }
+    size_t best = 0;
+    for (size_t t = 0; t < n_tris; t++) {
+        emitted[t] = false;
+        tri_score[t] = vert_score[mesh_index(mesh, t * 3)] +
+                       vert_score[mesh_index(mesh, t * 3 + 1)] +
+                       vert_score[mesh_index(mesh, t * 3 + 2)];
+        if (tri_score[t] > tri_score[best]) {
+            best = t;
+        }
+    }
+
+    uint32_t cache[CACHE_SIZE + 3];
+    int n_cached = 0;
+    size_t next_unemitted = 0;
+    for (size_t n_out = 0; n_out < n_tris; n_out++) {
+        if (best == (size_t)-1) {
+            // Nothing in the cache has live triangles left: continue with
+            // the first triangle that has not been emitted.
+            while (emitted[next_unemitted]) {
+                next_unemitted++;
+            }
+            best = next_unemitted;
+        }
+        emitted[best] = true;
+        uint32_t tri[3];
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = mesh_index(mesh, best * 3 + k);
+            tri[k] = v;
+            out[n_out * 3 + k] = v;
+            uint32_t* tris = &vert_tris[first_tri[v]];
+            for (uint32_t j = 0; j < n_live[v]; j++) {
+                if (tris[j] == best) {
+                    tris[j] = tris[--n_live[v]];
+                    tris[n_live[v]] = best;
+                    break;
+                }
+            }
+        }
+
+        // Move the triangle's vertices to the front of the LRU cache.
+        uint32_t new_cache[CACHE_SIZE + 3];
+        int n_new = 0;
+        for (int k = 0; k < 3; k++) {
+            if (k == 0 || (tri[k] != tri[0] && (k == 1 || tri[k] != tri[1]))) {
+                new_cache[n_new++] = tri[k];
+            }
+        }
+        for (int i = 0; i < n_cached; i++) {
+            uint32_t v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                new_cache[n_new++] = v;
+            }
+        }
+        for (int i = 0; i < n_new; i++) {
+            uint32_t v = new_cache[i];
+            cache_pos[v] = i < CACHE_SIZE ? i : -1;
+            vert_score[v] = vertex_score(cache_pos[v], n_live[v]);
+        }
+
+        best = (size_t)-1;
+        float best_score = -1;
+        for (int i = 0; i < n_new; i++) {
+            uint32_t v = new_cache[i];
+            const uint32_t* tris = &vert_tris[first_tri[v]];
+            for (uint32_t j = 0; j < n_live[v]; j++) {
+                uint32_t t = tris[j];
+                tri_score[t] = vert_score[mesh_index(mesh, t * 3)] +
+                               vert_score[mesh_index(mesh, t * 3 + 1)] +
+                               vert_score[mesh_index(mesh, t * 3 + 2)];
+                if (tri_score[t] > best_score) {
+                    best_score = tri_score[t];
+                    best = t;
+                }
+            }
+        }
+        n_cached = n_new < CACHE_SIZE ? n_new : CACHE_SIZE;
+        memcpy(cache, new_cache, n_cached * sizeof *cache);
+    }
+    for (size_t i = 0; i < n_tris * 3; i++) {
+        mesh_set_index(mesh, i, out[i]);
+    }
+    return true;
+}
+
+bool optimize_vertex_cache_range(Mesh* mesh, size_t first_index,
+                                 size_t n_indices, uint32_t* local) {
+    // The range uses at most n_indices vertices. global maps them back.
+    Arena scratch = {0};
+    uint32_t* indices = arena_alloc(&scratch, n_indices * sizeof *indices);
+    uint32_t* global = arena_alloc(&scratch, n_indices * sizeof *global);
+    if (!indices || !global) {
+        arena_free(&scratch);
+        return false;
+    }
+    uint32_t n_used = 0;
+    for (size_t i = 0; i < n_indices; i++) {
+        uint32_t v = mesh_index(mesh, first_index + i);
+        if (local[v] == UINT32_MAX) {
+            local[v] = n_used;
+            global[n_used++] = v;
+        }
+        indices[i] = local[v];
+    }
+    Mesh range = {
+        .indices = indices,
+        .n_indices = n_indices,
+        .index_size = sizeof *indices,
+        .n_verts = n_used,
+    };
+    bool ok = optimize_vertex_cache(&scratch, &range);
+    for (size_t i = 0; ok && i < n_indices; i++) {
+        mesh_set_index(mesh, first_index + i, global[indices[i]]);
+    }
+    for (uint32_t v = 0; v < n_used; v++) {
+        local[global[v]] = UINT32_MAX;
+    }
+    arena_free(&scratch);
+    return ok;
+}
+
+bool optimize_vertex_fetch(Arena* arena, Mesh* mesh) {
+    uint32_t* remap = arena_alloc(arena, mesh->n_verts * sizeof *remap);
+    float* verts = arena_alloc(arena,
+                               mesh->n_verts * MESH_STRIDE * sizeof *verts);
+    if (!remap || !verts) {
+        return false;
+    }
+    memset(remap, 0xff, mesh->n_verts * sizeof *remap);
+    uint32_t n_used = 0;
+    for (size_t i = 0; i < mesh->n_indices; i++) {
+        uint32_t v = mesh_index(mesh, i);
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = n_used;
+            memcpy(&verts[n_used * MESH_STRIDE],
+                   &mesh->verts[v * MESH_STRIDE],
+                   MESH_STRIDE * sizeof *verts);
+            n_used++;
+        }
+        mesh_set_index(mesh, i, remap[v]);
+    }
+    // Vertices no triangle uses are dropped.
+    mesh->verts = verts;
+    mesh->n_verts = n_used;
+    return true;
+}
+
+bool optimize_mesh(Arena* arena, Mesh* mesh, float* acmr_before,
+                   float* acmr_after) {
+    *acmr_before = mesh_acmr(mesh, 16);
+    if (!build_clusters(arena, mesh) ||
+        !optimize_vertex_fetch(arena, mesh)) {
+        return false;
+    }
+    *acmr_after = mesh_acmr(mesh, 16);
+    return true;
+}
+
+static void cluster_bounds(const Mesh* mesh, Cluster* c) {
+    float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    float axis[3] = {0};
+    for (uint32_t i = c->first_index; i < c->first_index + c->n_indices;
+         i++) {
+        const float* p = &mesh->verts[mesh_index(mesh, i) * MESH_STRIDE];
+        for (int k = 0; k < 3; k++) {
+            min[k] = p[k] < min[k] ? p[k] : min[k];
+            max[k] = p[k] > max[k] ? p[k] : max[k];
+        }
+    }
+    for (int k = 0; k < 3; k++) {
+        c->center[k] = (min[k] + max[k]) * 0.5f;
+    }
+
+    // Unit triangle normals from the winding, as used for face culling.
+    float normals[CLUSTER_MAX_TRIS][3];
+    int n_normals = 0;
+    float r_sq = 0;
+    for (uint32_t i = c->first_index; i < c->first_index + c->n_indices;
+         i += 3) {
+        const float* p[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = &mesh->verts[mesh_index(mesh, i + k) * MESH_STRIDE];
+            float d[3] = {p[k][0] - c->center[0], p[k][1] - c->center[1],
+                          p[k][2] - c->center[2]};
+            float dist_sq = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            r_sq = dist_sq > r_sq ? dist_sq : r_sq;
+        }
+        float e1[3], e2[3];
+        for (int k = 0; k < 3; k++) {
+            e1[k] = p[1][k] - p[0][k];
+            e2[k] = p[2][k] - p[0][k];
+        }
+        float* n = normals[n_normals];
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len == 0) {
+            // Degenerate triangles are never drawn.
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            n[k] /= len;
+            axis[k] += n[k];
+        }
+        n_normals++;
+    }
+    c->radius = sqrtf(r_sq);
+
+    float len = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] +
+                      axis[2] * axis[2]);
+    float min_dot = 1;
+    for (int k = 0; k < 3; k++) {
+        c->cone_axis[k] = len > 0 ? axis[k] / len : 0;
+    }
+    for (int i = 0; i < n_normals; i++) {
+        float d = normals[i][0] * c->cone_axis[0] +
+                  normals[i][1] * c->cone_axis[1] +
+                  normals[i][2] * c->cone_axis[2];
+        min_dot = d < min_dot ? d : min_dot;
+    }
+    // With a cone of half angle 90 degrees or more some triangle always
+    // faces the camera.
+    c->cone_cutoff = len > 0 && min_dot > 0 ? sqrtf(1 - min_dot * min_dot)
+                                            : 1;
+}
+
+typedef struct {
+    uint64_t key;
+    uint32_t tri;
+} TriKey;
+
+static int compare_tri_keys(const void* a, const void* b) {
+    const TriKey* ka = a;
+    const TriKey* kb = b;
+    if (ka->key != kb->key) {
+        return ka->key < kb->key ? -1 : 1;
+    }
+    return ka->tri < kb->tri ? -1 : ka->tri > kb->tri;
+}
+
+// Spreads the low 10 bits of x out to every third bit.
+static uint32_t spread_bits(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | x << 16) & 0x30000ff;
+    x = (x | x << 8) & 0x300f00f;
+    x = (x | x << 4) & 0x30c30c3;
+    x = (x | x << 2) & 0x9249249;
+    return x;
+}
+
+// Sort key of a triangle: its submesh, the axis direction closest to its
+// normal, then the Morton code of its centroid.
+static uint64_t tri_key(const Mesh* mesh, size_t t, uint64_t submesh) {
+    const float* p[3];
+    for (int k = 0; k < 3; k++) {
+        p[k] = &mesh->verts[mesh_index(mesh, t * 3 + k) * MESH_STRIDE];
+    }
+    float e1[3], e2[3], n[3];
+    for (int k = 0; k < 3; k++) {
+        e1[k] = p[1][k] - p[0][k];
+        e2[k] = p[2][k] - p[0][k];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    int axis = 0;
+    for (int k = 1; k < 3; k++) {
+        if (fabsf(n[k]) > fabsf(n[axis])) {
+            axis = k;
+        }
+    }
+    uint64_t dir = axis * 2 + (n[axis] < 0);
+    uint32_t morton = 0;
+    for (int k = 0; k < 3; k++) {
+        float extent = mesh->max[k] - mesh->min[k];
+        float c = (p[0][k] + p[1][k] + p[2][k]) / 3 - mesh->min[k];
+        float q = extent > 0 ? c / extent * 1023 : 0;
+        morton |= spread_bits(q < 0 ? 0 : q > 1023 ? 1023 : q) << k;
+    }
+    return submesh << 33 | dir << 30 | morton;
+}
+
+bool build_clusters(Arena* arena, Mesh* mesh) {
+    size_t n_tris = mesh->n_indices / 3;
+    if (n_tris == 0) {
+        return true;
+    }
+    // Group the triangles by submesh and facing direction, so that cluster
+    // normal cones are narrow, and order each group along a space-filling
+    // curve, so that clusters are compact where the cache order below has
+    // no shared vertices to follow. Submeshes keep their index ranges.
+    TriKey* keys = arena_alloc(arena, n_tris * sizeof *keys);
+    uint32_t* sorted = arena_alloc(arena, n_tris * 3 * sizeof *sorted);
+    if (!keys || !sorted) {
+        return false;
+    }
+    size_t sub = 0;
+    for (size_t t = 0; t < n_tris; t++) {
+        while (sub + 1 < mesh->n_submeshes &&
+               t * 3 >= mesh->submeshes[sub + 1].lods[0].first_index) {
+            sub++;
+        }
+        keys[t] = (TriKey){tri_key(mesh, t, sub), t};
+    }
+    qsort(keys, n_tris, sizeof *keys, compare_tri_keys);
+    for (size_t t = 0; t < n_tris; t++) {
+        for (int k = 0; k < 3; k++) {
+            sorted[t * 3 + k] = mesh_index(mesh, keys[t].tri * 3 + k);
+        }
+    }
+    for (size_t i = 0; i < n_tris * 3; i++) {
+        mesh_set_index(mesh, i, sorted[i]);
+    }
+
+    // Upper bound: each cluster is full on vertices or on triangles, or is
+    // the last one of its group. A triangle adds at most 3 vertices.
+    size_t n_groups = 6 * (mesh->n_submeshes ? mesh->n_submeshes : 1);
+    size_t max_clusters = n_tris / (CLUSTER_MAX_VERTS / 3) + n_groups;
+    Cluster* clusters = arena_alloc(arena, max_clusters * sizeof *clusters);
+    // Cluster number + 1 that last used each vertex.
+    uint32_t* seen = arena_alloc(arena, mesh->n_verts * sizeof *seen);
+    uint32_t* local = arena_alloc(arena, mesh->n_verts * sizeof *local);
+    if (!clusters || !seen || !local) {
+        return false;
+    }
+    memset(seen, 0, mesh->n_verts * sizeof *seen);
+    memset(local, 0xff, mesh->n_verts * sizeof *local);
+    size_t n_clusters = 0;
+    for (size_t first = 0; first < n_tris;) {
+        size_t end = first + 1;
+        while (end < n_tris && keys[end].key >> 30 == keys[first].key >> 30) {
+            end++;
+        }
+        if (!optimize_vertex_cache_range(mesh, first * 3, (end - first) * 3,
+                                         local)) {
+            return false;
+        }
+
+        Cluster* c = NULL;
+        int n_verts = 0;
+        for (size_t t = first; t < end; t++) {
+            uint32_t tri[3];
+            int n_new = 0;
+            for (int k = 0; k < 3; k++) {
+                tri[k] = mesh_index(mesh, t * 3 + k);
+                if (!c || seen[tri[k]] != n_clusters) {
+                    n_new++;
+                }
+            }
+            if (!c || n_verts + n_new > CLUSTER_MAX_VERTS ||
+                c->n_indices == CLUSTER_MAX_TRIS * 3) {
+                c = &clusters[n_clusters++];
+                *c = (Cluster){.first_index = t * 3};
+                n_verts = 0;
+            }
+            for (int k = 0; k < 3; k++) {
+                if (seen[tri[k]] != n_clusters) {
+                    seen[tri[k]] = n_clusters;
+                    n_verts++;
+                }
+            }
+            c->n_indices += 3;
+        }
+        first = end;
+    }
+    // Clusters never span submeshes, so each has a run of them.
+    size_t next = 0;
+    for (size_t i = 0; i < mesh->n_submeshes; i++) {
+        Submesh* sub = &mesh->submeshes[i];
+        uint32_t end = sub->lods[0].first_index + sub->lods[0].n_indices;
+        sub->first_cluster = next;
+        while (next < n_clusters && clusters[next].first_index < end) {
+            next++;
+        }
+        sub->n_clusters = next - sub->first_cluster;
+    }
+    for (size_t i = 0; i < n_clusters; i++) {
+        cluster_bounds(mesh, &clusters[i]);
+    }
+    mesh->clusters = clusters;
+    mesh->n_clusters = n_clusters;
+    return true;
+}
+
+void frustum_from_mvp(Frustum* frustum, const float mvp[16]) {
+    // Gribb and Hartmann: the sums and differences of the last row of mvp
+    // with the others.
+    for (int i = 0; i < 6; i++) {
+        float* plane = frustum->planes[i];
+        const float* row = &mvp[(i / 2) * 4];
+        float sign = i % 2 ? -1 : 1;
+        float len_sq = 0;
+        for (int k = 0; k < 4; k++) {
+            plane[k] = mvp[12 + k] + sign * row[k];
+            len_sq += k < 3 ? plane[k] * plane[k] : 0;
+        }
+        float inv = len_sq > 0 ? 1 / sqrtf(len_sq) : 0;
+        for (int k = 0; k < 4; k++) {
+            plane[k] *= inv;
+        }
+    }
+}
+
+bool sphere_in_frustum(const Frustum* frustum, const float center[3],
+                       float radius) {
+    for (int i = 0; i < 6; i++) {
+        const float* plane = frustum->planes[i];
+        if (plane[0] * center[0] + plane[1] * center[1] +
+            plane[2] * center[2] + plane[3] < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t cull_clusters(const Cluster* clusters, size_t n_clusters,
+                     const Frustum* frustum, const float camera[3],
+                     uint32_t* visible) {
+    size_t n_visible = 0;
+    for (size_t i = 0; i < n_clusters; i++) {
+        const Cluster* c = &clusters[i];
+        if (!sphere_in_frustum(frustum, c->center, c->radius)) {
+            continue;
+        }
+        if (c->cone_cutoff < 1) {
+            // Every point in the sphere is seen from behind by every
+            // triangle if the direction to it is within 90 degrees minus
+            // the cone angle of the axis. Allowing for the radius both
+            // in the dot product and in the distance keeps this
+            // conservative.
+            float v[3] = {c->center[0] - camera[0], c->center[1] - camera[1],
+                          c->center[2] - camera[2]};
+            float dist = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+            float d = v[0] * c->cone_axis[0] + v[1] * c->cone_axis[1] +
+                      v[2] * c->cone_axis[2];
+            if (d - c->radius >= c->cone_cutoff * (dist + c->radius)) {
+                continue;
+            }
+        }
+        visible[n_visible++] = i;
+    }
+    return n_visible;
+}
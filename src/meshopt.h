@@ -0,0 +1,59 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include "arena.h"
+#include "mesh.h"
+#include <stdbool.h>
+
+// Average cache miss ratio: vertex shader runs per triangle with a FIFO
+// post-transform cache of cache_size entries. 0.5 is the best possible on
+// large regular meshes, 3 is no reuse at all.
+float mesh_acmr(const Mesh* mesh, int cache_size);
+
+// Reorders triangles so that consecutive ones share vertices, using Tom
+// Forsyth's linear-speed vertex cache optimization.
+bool optimize_vertex_cache(Arena* arena, Mesh* mesh);
+
+// Runs optimize_vertex_cache on n_indices indices of mesh from first_index
+// only. The vertices they use are numbered from 0 for it, so time and
+// memory depend on the size of the range, not of the mesh. local is
+// scratch space of mesh->n_verts entries that must all be UINT32_MAX, and
+// are left that way.
+bool optimize_vertex_cache_range(Mesh* mesh, size_t first_index,
+                                 size_t n_indices, uint32_t* local);
+
+// Renumbers vertices in order of first use, so that vertex fetches walk
+// the vertex buffer front to back.
+bool optimize_vertex_fetch(Arena* arena, Mesh* mesh);
+
+// Sorts the triangles of each submesh into groups facing roughly the same
+// way, optimizes each group for the vertex cache, and splits the groups
+// into clusters of at most 64 vertices and 124 triangles with their
+// bounds. Must run before build_lods.
+bool build_clusters(Arena* arena, Mesh* mesh);
+
+// Builds clusters, reorders the vertices for fetching, and reports the ACMR
+// before and after, measured with a 16 entry cache.
+bool optimize_mesh(Arena* arena, Mesh* mesh, float* acmr_before,
+                   float* acmr_after);
+
+// View frustum in model space: six planes with unit normals pointing
+// inward, as (a, b, c, d) for a x + b y + c z + d >= 0.
+typedef struct {
+    float planes[6][4];
+} Frustum;
+
+// Extracts the frustum from proj * view * model (row-major, as Mat4).
+void frustum_from_mvp(Frustum* frustum, const float mvp[16]);
+bool sphere_in_frustum(const Frustum* frustum, const float center[3],
+                       float radius);
+
+// Writes the indices of the clusters that may be visible to visible, and
+// returns how many there are. Clusters are dropped if their bounding
+// sphere is outside the frustum, or if every triangle faces away from
+// camera, the camera position in model space.
+size_t cull_clusters(const Cluster* clusters, size_t n_clusters,
+                     const Frustum* frustum, const float camera[3],
+                     uint32_t* visible);
+
+#endif // MESHOPT_H
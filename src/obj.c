@@ -0,0 +1,1029 @@
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+#include "obj.h"
+#include "file.h"
+#include "float_parse.h"
+#include "linalg.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/types.h>
+#endif
+
+enum {
+    PARSE_ATTRIBS = 1,
+    PARSE_FACES = 2,
+};
+
+// A triangle corner as 1-based indices into the attribute arrays, where 0
+// means missing. If vn has FACE_NORMAL set, the rest of it is the index of
+// the triangle whose face normal the corner gets.
+typedef struct {
+    uint32_t v, vt, vn;
+} Corner;
+
+#define FACE_NORMAL 0x80000000u
+
+// An `o` or `usemtl` line, which starts a new submesh at the next face.
+// The name points into the file.
+typedef struct {
+    size_t first_face;
+    const char* name;
+    size_t name_len;
+    bool is_material;
+} ObjMarker;
+
+// Parsed records. With flags 0 records are only counted; otherwise the
+// selected kinds are stored into arrays allocated from those counts. The
+// n_* fields are global indices, so a chunk of the file starts with the
+// number of records in all chunks before it.
+typedef struct {
+    int flags;
+    float* verts;
+    size_t n_verts;
+    float* texs;
+    size_t n_texs;
+    float* norms;
+    size_t n_norms;
+    Corner* faces;
+    size_t n_faces;
+    ObjMarker* markers;
+    size_t n_markers;
+    // File name from the first `mtllib` line, pointing into the file.
+    const char* mtllib;
+    size_t mtllib_len;
+} ObjData;
+
+typedef struct {
+    const char* begin;
+    const char* end;
+    ObjData d;
+} ObjChunk;
+
+// Files are only split when every chunk gets at least this many bytes.
+#define OBJ_MIN_CHUNK (256 * 1024)
+
+// Returns the first '\n' in [p, end), or end if the line is not terminated.
+static const char* find_eol(const char* p, const char* end) {
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static const char* skip_space(const char* p, const char* end) {
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char* skip_token(const char* p, const char* end) {
+    while (p < end && !is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+// Trims whitespace from both ends of [*p, *end).
+static void trim(const char** p, const char** end) {
+    *p = skip_space(*p, *end);
+    while (*end > *p && is_space((*end)[-1])) {
+        (*end)--;
+    }
+}
+
+// Parses up to n whitespace separated floats. Missing values become 0.
+static void parse_floats(const char* p, const char* end, float* out, int n) {
+    for (int i = 0; i < n; i++) {
+        p = skip_space(p, end);
+        const char* tok = p;
+        p = skip_token(p, end);
+        double d = 0;
+        if (tok < p) {
+            parse_double(tok, p, &d);
+        }
+        out[i] = d;
+    }
+}
+
+// Parses a 1-based (or negative, relative) OBJ index and returns it as a
+// 0-based index into an array of n elements. Missing or invalid indices
+// give (size_t)-1 so that they fail the caller's range check.
+static size_t parse_index(const char** p, const char* end, size_t n) {
+    const char* s = *p;
+    bool neg = false;
+    if (s < end && *s == '-') {
+        neg = true;
+        s++;
+    }
+    const char* digits = s;
+    size_t i = 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        i = i * 10 + (*s - '0');
+        s++;
+    }
+    *p = s;
+    if (s == digits || i == 0) {
+        return (size_t)-1;
+    }
+    if (neg) {
+        return i <= n ? n - i : (size_t)-1;
+    }
+    return i - 1;
+}
+
+static Corner parse_corner(const char* s, const char* end, const ObjData* d) {
+    Corner c = {0};
+    size_t i = parse_index(&s, end, d->n_verts);
+    if (i < d->n_verts) {
+        c.v = i + 1;
+    }
+    if (s < end && *s == '/') {
+        s++;
+        i = parse_index(&s, end, d->n_texs);
+        if (i < d->n_texs) {
+            c.vt = i + 1;
+        }
+        if (s < end && *s == '/') {
+            s++;
+            i = parse_index(&s, end, d->n_norms);
+            if (i < d->n_norms) {
+                c.vn = i + 1;
+            }
+        }
+    }
+    return c;
+}
+
+static bool has_normal(Corner c, const ObjData* d) {
+    if (c.vn == 0) {
+        return false;
+    }
+    const float* n = &d->norms[(c.vn - 1) * 3];
+    return n[0] != 0 || n[1] != 0 || n[2] != 0;
+}
+
+static void add_face(const char* p, const char* end, ObjData* d) {
+    Corner first = {0}, prev = {0};
+    int n_corners = 0;
+    for (;;) {
+        p = skip_space(p, end);
+        if (p == end) {
+            break;
+        }
+        const char* tok = p;
+        p = skip_token(p, end);
+        n_corners++;
+        if (!(d->flags & PARSE_FACES)) {
+            continue;
+        }
+        Corner cur = parse_corner(tok, p, d);
+        if (n_corners == 1) {
+            first = cur;
+        } else if (n_corners >= 3) {
+            Corner* f = &d->faces[d->n_faces * 3];
+            f[0] = first;
+            f[1] = prev;
+            f[2] = cur;
+            if (!has_normal(first, d)) {
+                f[0].vn = f[1].vn = f[2].vn = FACE_NORMAL | d->n_faces;
+            }
+            d->n_faces++;
+        }
+        prev = cur;
+    }
+    if (!(d->flags & PARSE_FACES) && n_corners >= 3) {
+        d->n_faces += n_corners - 2;
+    }
+}
+
+static void parse_line(const char* p, const char* end, ObjData* d) {
+    p = skip_space(p, end);
+    const char* cmd = p;
+    p = skip_token(p, end);
+    size_t cmd_len = p - cmd;
+    if (cmd_len == 1 && cmd[0] == 'v') {
+        if (d->flags & PARSE_ATTRIBS) {
+            parse_floats(p, end, &d->verts[d->n_verts*3], 3);
+        }
+        d->n_verts++;
+    } else if (cmd_len == 2 && cmd[0] == 'v' && cmd[1] == 't') {
+        if (d->flags & PARSE_ATTRIBS) {
+            parse_floats(p, end, &d->texs[d->n_texs*2], 2);
+        }
+        d->n_texs++;
+    } else if (cmd_len == 2 && cmd[0] == 'v' && cmd[1] == 'n') {
+        if (d->flags & PARSE_ATTRIBS) {
+            parse_floats(p, end, &d->norms[d->n_norms*3], 3);
+        }
+        d->n_norms++;
+    } else if (cmd_len == 1 && cmd[0] == 'f') {
+        if (d->flags == 0 || (d->flags & PARSE_FACES)) {
+            add_face(p, end, d);
+        }
+    } else if ((cmd_len == 1 && cmd[0] == 'o') ||
+               (cmd_len == 6 && memcmp(cmd, "usemtl", 6) == 0)) {
+        if (d->flags & PARSE_FACES) {
+            trim(&p, &end);
+            d->markers[d->n_markers] = (ObjMarker){
+                d->n_faces, p, end - p, cmd_len == 6
+            };
+        }
+        if (d->flags == 0 || (d->flags & PARSE_FACES)) {
+            d->n_markers++;
+        }
+    } else if (cmd_len == 6 && memcmp(cmd, "mtllib", 6) == 0) {
+        if ((d->flags & PARSE_FACES) && !d->mtllib) {
+            trim(&p, &end);
+            d->mtllib = p;
+            d->mtllib_len = end - p;
+        }
+    }
+}
+
+static void parse_lines(const char* c, const char* end, ObjData* d) {
+    while (c < end) {
+        const char* eol = find_eol(c, end);
+        parse_line(c, eol, d);
+        c = eol + 1;
+    }
+}
+
+static void parse_chunk(void* arg) {
+    ObjChunk* chunk = arg;
+    parse_lines(chunk->begin, chunk->end, &chunk->d);
+}
+
+static void parse_chunks(Pool* pool, ObjChunk* chunks, size_t n_chunks) {
+    if (!pool || n_chunks == 1) {
+        for (size_t i = 0; i < n_chunks; i++) {
+            parse_chunk(&chunks[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < n_chunks; i++) {
+        pool_submit(pool, parse_chunk, &chunks[i]);
+    }
+    pool_wait(pool);
+}
+
+// Splits [begin, end) into about n_chunks pieces at line boundaries.
+static size_t split_lines(const char* begin, const char* end,
+                          ObjChunk* chunks, size_t n_chunks) {
+    size_t len = end - begin;
+    size_t n = 0;
+    const char* c = begin;
+    for (size_t i = 1; i <= n_chunks && c < end; i++) {
+        const char* e = end;
+        if (i < n_chunks) {
+            const char* target = begin + len / n_chunks * i;
+            if (target < c) {
+                target = c;
+            }
+            e = find_eol(target, end);
+            if (e < end) {
+                e++;
+            }
+        }
+        chunks[n++] = (ObjChunk){.begin = c, .end = e};
+        c = e;
+    }
+    return n;
+}
+
+static uint32_t hash_corner(Corner c) {
+    uint32_t h = c.v * 0x9e3779b1u;
+    h ^= c.vt * 0x85ebca77u + (h << 6) + (h >> 2);
+    h ^= c.vn * 0xc2b2ae3du + (h << 6) + (h >> 2);
+    return h ^ (h >> 16);
+}
+
+static Vec3 corner_pos(Corner c, const ObjData* d) {
+    if (c.v == 0) {
+        return vec3(0, 0, 0);
+    }
+    const float* p = &d->verts[(c.v - 1) * 3];
+    return vec3(p[0], p[1], p[2]);
+}
+
+static void corner_vertex(float* f, Corner c, const ObjData* d) {
+    Vec3 pos = corner_pos(c, d);
+    f[0] = pos.x;
+    f[1] = pos.y;
+    f[2] = pos.z;
+    f[3] = f[4] = f[5] = f[6] = f[7] = 0;
+    if (c.vt) {
+        f[3] = d->texs[(c.vt - 1) * 2];
+        f[4] = d->texs[(c.vt - 1) * 2 + 1];
+    }
+    if (c.vn & FACE_NORMAL) {
+        const Corner* tri = &d->faces[(c.vn & ~FACE_NORMAL) * 3];
+        Vec3 v1 = corner_pos(tri[0], d);
+        Vec3 v2 = corner_pos(tri[1], d);
+        Vec3 v3 = corner_pos(tri[2], d);
+        Vec3 norm = vec_norm(vec_cross(vec_to(v1, v2), vec_to(v1, v3)));
+        f[5] = norm.x;
+        f[6] = norm.y;
+        f[7] = norm.z;
+    } else if (c.vn) {
+        f[5] = d->norms[(c.vn - 1) * 3];
+        f[6] = d->norms[(c.vn - 1) * 3 + 1];
+        f[7] = d->norms[(c.vn - 1) * 3 + 2];
+    }
+}
+
+// Turns the corner list into a vertex buffer with one vertex per distinct
+// (v, vt, vn) and an index buffer. Vertices are numbered in order of first
+// use. Corners with a computed face normal are never shared.
+static bool build_mesh(Arena* arena, const ObjData* d, Mesh* mesh) {
+    size_t n_corners = d->n_faces * 3;
+    if (n_corners >= UINT32_MAX) {
+        return false;
+    }
+    size_t cap = 16;
+    while (cap < n_corners * 2) {
+        cap *= 2;
+    }
+    uint32_t* indices = arena_alloc(arena, n_corners * sizeof *indices);
+    uint32_t* vert_corner = arena_alloc(arena, n_corners * sizeof *vert_corner);
+    uint32_t* table = arena_alloc(arena, cap * sizeof *table);
+    if (!indices || !vert_corner || !table) {
+        return false;
+    }
+    memset(table, 0xff, cap * sizeof *table);
+    uint32_t n_verts = 0;
+    for (size_t i = 0; i < n_corners; i++) {
+        Corner c = d->faces[i];
+        if (c.vn & FACE_NORMAL) {
+            vert_corner[n_verts] = i;
+            indices[i] = n_verts++;
+            continue;
+        }
+        size_t h = hash_corner(c) & (cap - 1);
+        for (;;) {
+            uint32_t v = table[h];
+            if (v == UINT32_MAX) {
+                table[h] = n_verts;
+                vert_corner[n_verts] = i;
+                indices[i] = n_verts++;
+                break;
+            }
+            Corner o = d->faces[vert_corner[v]];
+            if (o.v == c.v && o.vt == c.vt && o.vn == c.vn) {
+                indices[i] = v;
+                break;
+            }
+            h = (h + 1) & (cap - 1);
+        }
+    }
+
+    float* verts = arena_alloc(arena,
+                               n_verts * MESH_STRIDE * sizeof (float));
+    if (!verts) {
+        return false;
+    }
+    for (uint32_t v = 0; v < n_verts; v++) {
+        corner_vertex(&verts[v * MESH_STRIDE], d->faces[vert_corner[v]], d);
+    }
+    mesh->verts = verts;
+    mesh->n_verts = n_verts;
+    mesh->indices = indices;
+    mesh->n_indices = n_corners;
+    mesh->index_size = sizeof (uint32_t);
+    if (n_verts <= 0x10000) {
+        // Narrowing front to back never overwrites an unread index.
+        uint16_t* small = (uint16_t*)indices;
+        for (size_t i = 0; i < n_corners; i++) {
+            small[i] = indices[i];
+        }
+        mesh->index_size = sizeof (uint16_t);
+    }
+    mesh_compute_bounds(mesh);
+    return true;
+}
+
+static void copy_name(char* dst, const char* src, size_t len) {
+    if (len >= SUBMESH_NAME_SIZE) {
+        len = SUBMESH_NAME_SIZE - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+// Makes a submesh of every run of faces between `o` and `usemtl` lines.
+// Object and material names carry over until they are changed.
+static bool build_submeshes(Arena* arena, const ObjData* d, Mesh* mesh) {
+    Submesh* subs = arena_alloc(arena, (d->n_markers + 1) * sizeof *subs);
+    if (!subs) {
+        return false;
+    }
+    Submesh cur = {0};
+    size_t n = 0;
+    size_t first = 0;
+    for (size_t i = 0; i <= d->n_markers; i++) {
+        size_t end = i < d->n_markers ? d->markers[i].first_face
+                                      : d->n_faces;
+        if (end > first) {
+            subs[n] = cur;
+            subs[n].lods[0] = (MeshLod){first * 3, (end - first) * 3, 0, 0};
+            n++;
+            first = end;
+        }
+        if (i < d->n_markers) {
+            const ObjMarker* m = &d->markers[i];
+            copy_name(m->is_material ? cur.material : cur.name, m->name,
+                      m->name_len);
+        }
+    }
+    mesh->submeshes = subs;
+    mesh->n_submeshes = n;
+    return true;
+}
+
+bool read_obj_file(Arena* arena, Pool* pool, const char* file_name,
+                   Mesh* mesh) {
+    *mesh = (Mesh){0};
+    MappedFile file;
+    if (!map_file(&file, file_name)) {
+        fprintf(stderr, "Could not read obj file %s\n", file_name);
+        return false;
+    }
+    const char* content = file.data;
+    const char* end = content + file.len;
+
+    size_t n_chunks = 1;
+    if (pool) {
+        // A few chunks per thread evens out chunks with more faces.
+        n_chunks = pool_size(pool) * 4;
+        if (n_chunks > file.len / OBJ_MIN_CHUNK + 1) {
+            n_chunks = file.len / OBJ_MIN_CHUNK + 1;
+        }
+    }
+    ObjChunk* chunks = arena_alloc(arena, n_chunks * sizeof *chunks);
+    if (!chunks) {
+        fprintf(stderr, "Out of memory loading %s\n", file_name);
+        unmap_file(&file);
+        return false;
+    }
+    n_chunks = split_lines(content, end, chunks, n_chunks);
+    parse_chunks(pool, chunks, n_chunks);
+
+    ObjData total = {0};
+    for (size_t i = 0; i < n_chunks; i++) {
+        total.n_verts += chunks[i].d.n_verts;
+        total.n_texs += chunks[i].d.n_texs;
+        total.n_norms += chunks[i].d.n_norms;
+        total.n_faces += chunks[i].d.n_faces;
+        total.n_markers += chunks[i].d.n_markers;
+    }
+    size_t n_floats = total.n_verts*3 + total.n_texs*2 + total.n_norms*3;
+    float* mem = arena_alloc(arena, n_floats * sizeof (float));
+    Corner* faces = arena_alloc(arena, total.n_faces * 3 * sizeof *faces);
+    ObjMarker* markers = arena_alloc(arena,
+                                     total.n_markers * sizeof *markers);
+    if (!mem || !faces || !markers) {
+        fprintf(stderr, "Out of memory loading %s\n", file_name);
+        unmap_file(&file);
+        return false;
+    }
+    ObjData d = {0};
+    d.verts = mem;
+    d.texs = d.verts + total.n_verts*3;
+    d.norms = d.texs + total.n_texs*2;
+    d.faces = faces;
+    d.markers = markers;
+    for (size_t i = 0; i < n_chunks; i++) {
+        ObjData counts = chunks[i].d;
+        chunks[i].d = d;
+        d.n_verts += counts.n_verts;
+        d.n_texs += counts.n_texs;
+        d.n_norms += counts.n_norms;
+        d.n_faces += counts.n_faces;
+        d.n_markers += counts.n_markers;
+    }
+
+    if (n_chunks == 1) {
+        chunks[0].d.flags = PARSE_ATTRIBS | PARSE_FACES;
+        parse_chunks(pool, chunks, n_chunks);
+    } else {
+        // Faces can refer to attributes in any earlier chunk, so all
+        // attributes have to be in place before faces are resolved.
+        ObjData* starts = arena_alloc(arena, n_chunks * sizeof *starts);
+        if (!starts) {
+            fprintf(stderr, "Out of memory loading %s\n", file_name);
+            unmap_file(&file);
+            return false;
+        }
+        for (size_t i = 0; i < n_chunks; i++) {
+            starts[i] = chunks[i].d;
+            chunks[i].d.flags = PARSE_ATTRIBS;
+        }
+        parse_chunks(pool, chunks, n_chunks);
+        for (size_t i = 0; i < n_chunks; i++) {
+            chunks[i].d = starts[i];
+            chunks[i].d.flags = PARSE_FACES;
+        }
+        parse_chunks(pool, chunks, n_chunks);
+    }
+    // Submeshes need the marker names, which point into the file.
+    bool ok = build_submeshes(arena, &d, mesh);
+    for (size_t i = 0; i < n_chunks; i++) {
+        if (chunks[i].d.mtllib) {
+            copy_name(mesh->material_lib, chunks[i].d.mtllib,
+                      chunks[i].d.mtllib_len);
+            break;
+        }
+    }
+    unmap_file(&file);
+
+    if (!ok || !build_mesh(arena, &d, mesh)) {
+        fprintf(stderr, "Out of memory loading %s\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+// Streamed files are read this many bytes at a time, and vertices are
+// handed to the sink in batches of OBJ_STREAM_BATCH.
+#define OBJ_STREAM_WINDOW (1024 * 1024)
+#define OBJ_STREAM_BATCH 4096
+// Attributes are kept in pages of this many elements.
+#define OBJ_STREAM_PAGE 4096
+
+enum {
+    ATTRIB_V,
+    ATTRIB_VT,
+    ATTRIB_VN,
+    N_ATTRIBS
+};
+
+static const int attrib_widths[N_ATTRIBS] = {3, 2, 3};
+
+// The attributes of one kind while streaming. Elements are appended to
+// page, and each full page is copied to slot p % n_slots, where p is its
+// number. If there are fewer slots than pages, full pages are also written
+// to spill, and read back into their slot when a face needs them again.
+typedef struct {
+    int width;
+    size_t n;
+    float* page;
+    float* slots;
+    size_t* slot_pages;
+    size_t n_slots;
+    FILE* spill;
+} AttribPages;
+
+typedef struct {
+    ObjData d;
+    ObjStreamInfo info;
+    const ObjStreamSink* sink;
+    AttribPages attribs[N_ATTRIBS];
+    float* batch;
+    size_t n_batch;
+    size_t n_written;
+    bool io_error;
+} ObjStream;
+
+static size_t page_bytes(int width) {
+    return OBJ_STREAM_PAGE * width * sizeof (float);
+}
+
+// Spill files can pass 2 GB, so they are not addressed with a long, which
+// is 32 bits on some targets.
+#if defined(__unix__) || defined(__APPLE__)
+typedef off_t SpillOffset;
+#define spill_fseek fseeko
+#elif defined(_WIN32)
+typedef __int64 SpillOffset;
+#define spill_fseek _fseeki64
+#else
+typedef long SpillOffset;
+#define spill_fseek fseek
+#endif
+
+// Seeks to the start of page in a spill file, or fails if its offset does
+// not fit in a SpillOffset.
+static bool spill_seek(FILE* f, size_t page, int width) {
+    uint64_t max = sizeof (SpillOffset) >= 8 ? INT64_MAX : INT32_MAX;
+    size_t bytes = page_bytes(width);
+    if (page > max / bytes) {
+        return false;
+    }
+    return spill_fseek(f, (SpillOffset)((uint64_t)page * bytes),
+                       SEEK_SET) == 0;
+}
+
+static bool attrib_pages_init(AttribPages* a, Arena* arena, int width,
+                              size_t n_slots, bool spill) {
+    *a = (AttribPages){
+        .width = width,
+        .page = arena_alloc(arena, page_bytes(width)),
+        .slots = arena_alloc(arena, n_slots * page_bytes(width)),
+        .slot_pages = arena_alloc(arena, n_slots * sizeof (size_t)),
+        .n_slots = n_slots,
+        .spill = spill ? tmpfile() : NULL,
+    };
+    if (!a->page || !a->slots || !a->slot_pages || (spill && !a->spill)) {
+        return false;
+    }
+    for (size_t i = 0; i < n_slots; i++) {
+        a->slot_pages[i] = SIZE_MAX;
+    }
+    return true;
+}
+
+static void attrib_pages_close(AttribPages* a) {
+    if (a->spill) {
+        fclose(a->spill);
+    }
+}
+
+static bool attrib_push(AttribPages* a, const char* p, const char* end) {
+    size_t i = a->n % OBJ_STREAM_PAGE;
+    parse_floats(p, end, &a->page[i * a->width], a->width);
+    a->n++;
+    if (i + 1 < OBJ_STREAM_PAGE) {
+        return true;
+    }
+    size_t page = (a->n - 1) / OBJ_STREAM_PAGE;
+    size_t slot = page % a->n_slots;
+    memcpy(&a->slots[slot * OBJ_STREAM_PAGE * a->width], a->page,
+           page_bytes(a->width));
+    a->slot_pages[slot] = page;
+    return !a->spill ||
+           (spill_seek(a->spill, page, a->width) &&
+            fwrite(a->page, page_bytes(a->width), 1, a->spill) == 1);
+}
+
+// Returns element i, which must be below a->n, or NULL if it could not be
+// read back. The pointer is only valid until the next call.
+static const float* attrib_get(AttribPages* a, size_t i) {
+    size_t page = i / OBJ_STREAM_PAGE;
+    size_t offset = i % OBJ_STREAM_PAGE * a->width;
+    if (page == a->n / OBJ_STREAM_PAGE) {
+        return &a->page[offset];
+    }
+    size_t slot = page % a->n_slots;
+    float* data = &a->slots[slot * OBJ_STREAM_PAGE * a->width];
+    if (a->slot_pages[slot] != page) {
+        a->slot_pages[slot] = SIZE_MAX;
+        if (!spill_seek(a->spill, page, a->width) ||
+            fread(data, page_bytes(a->width), 1, a->spill) != 1) {
+            return NULL;
+        }
+        a->slot_pages[slot] = page;
+    }
+    return &data[offset];
+}
+
+// Copies the attribute of a corner index (1-based, 0 for none) to out, or
+// zeros if there is none.
+static bool copy_attrib(ObjStream* s, int kind, uint32_t index, float* out) {
+    AttribPages* a = &s->attribs[kind];
+    if (index == 0) {
+        memset(out, 0, a->width * sizeof (float));
+        return true;
+    }
+    const float* f = attrib_get(a, index - 1);
+    if (!f) {
+        s->io_error = true;
+        return false;
+    }
+    memcpy(out, f, a->width * sizeof (float));
+    return true;
+}
+
+// Reads f from the start in windows of whole lines and calls fn on every
+// line until it returns false. Fails on lines longer than the window.
+static bool stream_lines(FILE* f, char* window, size_t window_size,
+                         bool (*fn)(ObjStream*, const char*, const char*),
+                         ObjStream* s) {
+    rewind(f);
+    size_t len = 0;
+    for (;;) {
+        size_t n = fread(window + len, 1, window_size - len, f);
+        len += n;
+        const char* p = window;
+        const char* end = window + len;
+        const char* eol;
+        while ((eol = find_eol(p, end)) < end) {
+            if (!fn(s, p, eol)) {
+                return false;
+            }
+            p = eol + 1;
+        }
+        len = end - p;
+        if (n == 0) {
+            return !ferror(f) && (len == 0 || fn(s, p, end));
+        }
+        if (len == window_size) {
+            return false;
+        }
+        memmove(window, p, len);
+    }
+}
+
+// First pass: counts records, finds the bounds and the material library.
+static bool count_line(ObjStream* s, const char* p, const char* end) {
+    ObjData* d = &s->d;
+    p = skip_space(p, end);
+    const char* cmd = p;
+    p = skip_token(p, end);
+    size_t cmd_len = p - cmd;
+    if (cmd_len == 1 && cmd[0] == 'v') {
+        float pos[3];
+        parse_floats(p, end, pos, 3);
+        for (int i = 0; i < 3; i++) {
+            s->info.min[i] = fminf(s->info.min[i], pos[i]);
+            s->info.max[i] = fmaxf(s->info.max[i], pos[i]);
+        }
+        d->n_verts++;
+    } else if (cmd_len == 2 && cmd[0] == 'v' && cmd[1] == 't') {
+        d->n_texs++;
+    } else if (cmd_len == 2 && cmd[0] == 'v' && cmd[1] == 'n') {
+        d->n_norms++;
+    } else if (cmd_len == 1 && cmd[0] == 'f') {
+        add_face(p, end, d);
+    } else if (cmd_len == 6 && memcmp(cmd, "mtllib", 6) == 0 &&
+               !s->info.material_lib[0]) {
+        trim(&p, &end);
+        copy_name(s->info.material_lib, p, end - p);
+    }
+    return true;
+}
+
+static bool flush_batch(ObjStream* s) {
+    bool ok = s->sink->write(s->sink->user, s->n_written, s->batch,
+                             s->n_batch);
+    s->n_written += s->n_batch;
+    s->n_batch = 0;
+    return ok;
+}
+
+// Appends the three vertices of a triangle to the batch. As in
+// read_obj_file, the triangle gets its face normal if the first corner
+// has no normal.
+static bool stream_triangle(ObjStream* s, const Corner* tri) {
+    float* f = &s->batch[s->n_batch * MESH_STRIDE];
+    for (int k = 0; k < 3; k++) {
+        float* v = &f[k * MESH_STRIDE];
+        if (!copy_attrib(s, ATTRIB_V, tri[k].v, v) ||
+            !copy_attrib(s, ATTRIB_VT, tri[k].vt, v + 3) ||
+            !copy_attrib(s, ATTRIB_VN, tri[k].vn, v + 5)) {
+            return false;
+        }
+    }
+    if (f[5] == 0 && f[6] == 0 && f[7] == 0) {
+        Vec3 v1 = vec3(f[0], f[1], f[2]);
+        Vec3 v2 = vec3(f[MESH_STRIDE], f[MESH_STRIDE + 1],
+                       f[MESH_STRIDE + 2]);
+        Vec3 v3 = vec3(f[2 * MESH_STRIDE], f[2 * MESH_STRIDE + 1],
+                       f[2 * MESH_STRIDE + 2]);
+        Vec3 norm = vec_norm(vec_cross(vec_to(v1, v2), vec_to(v1, v3)));
+        for (int k = 0; k < 3; k++) {
+            memcpy(&f[k * MESH_STRIDE + 5], norm.v, sizeof norm.v);
+        }
+    }
+    s->n_batch += 3;
+    return s->n_batch + 3 <= OBJ_STREAM_BATCH || flush_batch(s);
+}
+
+// Second pass: stores attributes and streams the triangles of faces.
+// Corners can only refer to attributes above them, as in read_obj_file.
+static bool stream_line(ObjStream* s, const char* p, const char* end) {
+    ObjData* d = &s->d;
+    p = skip_space(p, end);
+    const char* cmd = p;
+    p = skip_token(p, end);
+    size_t cmd_len = p - cmd;
+    if (cmd_len != 1 || cmd[0] != 'f') {
+        int kind = -1;
+        if (cmd_len == 1 && cmd[0] == 'v') {
+            kind = ATTRIB_V;
+        } else if (cmd_len == 2 && cmd[0] == 'v' && cmd[1] == 't') {
+            kind = ATTRIB_VT;
+        } else if (cmd_len == 2 && cmd[0] == 'v' && cmd[1] == 'n') {
+            kind = ATTRIB_VN;
+        }
+        if (kind < 0) {
+            return true;
+        }
+        if (!attrib_push(&s->attribs[kind], p, end)) {
+            s->io_error = true;
+            return false;
+        }
+        d->n_verts = s->attribs[ATTRIB_V].n;
+        d->n_texs = s->attribs[ATTRIB_VT].n;
+        d->n_norms = s->attribs[ATTRIB_VN].n;
+        return true;
+    }
+    Corner tri[3];
+    int n_corners = 0;
+    for (;;) {
+        p = skip_space(p, end);
+        if (p == end) {
+            return true;
+        }
+        const char* tok = p;
+        p = skip_token(p, end);
+        Corner cur = parse_corner(tok, p, d);
+        if (n_corners < 3) {
+            tri[n_corners] = cur;
+        } else {
+            tri[1] = tri[2];
+            tri[2] = cur;
+        }
+        n_corners++;
+        if (n_corners >= 3 && !stream_triangle(s, tri)) {
+            return false;
+        }
+    }
+}
+
+// Sets up the attribute pages for the counts of the first pass with at
+// most budget bytes of slots, which must be enough for one slot of each
+// kind. If they do not all fit, each kind gets one slot and a share of
+// the rest in proportion to its size, and the kinds that still do not fit
+// spill.
+static bool stream_attribs_init(ObjStream* s, Arena* arena,
+                                const ObjData* counts, size_t budget) {
+    size_t n[N_ATTRIBS] = {counts->n_verts, counts->n_texs, counts->n_norms};
+    size_t n_pages[N_ATTRIBS];
+    size_t slot_bytes[N_ATTRIBS];
+    size_t total = 0;
+    size_t rest = budget;
+    for (int k = 0; k < N_ATTRIBS; k++) {
+        n_pages[k] = (n[k] + OBJ_STREAM_PAGE - 1) / OBJ_STREAM_PAGE;
+        slot_bytes[k] = page_bytes(attrib_widths[k]) + sizeof (size_t);
+        total += n_pages[k] * slot_bytes[k];
+        rest -= slot_bytes[k];
+    }
+    bool ok = true;
+    for (int k = 0; k < N_ATTRIBS && ok; k++) {
+        size_t n_slots = n_pages[k];
+        if (total > budget) {
+            double share = (double)n_pages[k] * slot_bytes[k] / total;
+            n_slots = 1 + (size_t)(rest * share) / slot_bytes[k];
+            n_slots = n_slots < n_pages[k] ? n_slots : n_pages[k];
+        }
+        ok = attrib_pages_init(&s->attribs[k], arena, attrib_widths[k],
+                               n_slots ? n_slots : 1, n_slots < n_pages[k]);
+    }
+    return ok;
+}
+
+bool stream_obj_file(const char* file_name, size_t mem_cap,
+                     const ObjStreamSink* sink) {
+    FILE* f = fopen(file_name, "rb");
+    if (!f) {
+        fprintf(stderr, "Could not read obj file %s\n", file_name);
+        return false;
+    }
+    Arena arena = {0};
+    ObjStream s = {.sink = sink};
+    for (int i = 0; i < 3; i++) {
+        s.info.min[i] = FLT_MAX;
+        s.info.max[i] = -FLT_MAX;
+    }
+    char* window = arena_alloc(&arena, OBJ_STREAM_WINDOW);
+    bool ok = window &&
+              stream_lines(f, window, OBJ_STREAM_WINDOW, count_line, &s);
+    if (!ok) {
+        fprintf(stderr, "Could not read obj file %s\n", file_name);
+    }
+
+    ObjData counts = s.d;
+    s.info.n_verts = counts.n_faces * 3;
+    // The window, a batch, and for each kind of attribute the page being
+    // filled and at least one slot.
+    size_t batch_bytes = OBJ_STREAM_BATCH * MESH_STRIDE * sizeof (float);
+    size_t fixed = OBJ_STREAM_WINDOW + batch_bytes;
+    size_t needed = fixed;
+    for (int k = 0; k < N_ATTRIBS; k++) {
+        needed += 2 * page_bytes(attrib_widths[k]) + sizeof (size_t);
+    }
+    if (ok && needed > mem_cap) {
+        fprintf(stderr, "Streaming %s needs at least %zu KB, more than the "
+                "%zu KB allowed\n", file_name, (needed >> 10) + 1,
+                mem_cap >> 10);
+        ok = false;
+    }
+    if (ok) {
+        size_t budget = mem_cap - fixed;
+        for (int k = 0; k < N_ATTRIBS; k++) {
+            budget -= page_bytes(attrib_widths[k]);
+        }
+        s.d = (ObjData){0};
+        s.batch = arena_alloc(&arena, batch_bytes);
+        ok = s.batch && stream_attribs_init(&s, &arena, &counts, budget);
+        if (!ok) {
+            fprintf(stderr, "Could not set up streaming of %s\n", file_name);
+        }
+    }
+    if (ok) {
+        ok = sink->begin(sink->user, &s.info) &&
+             stream_lines(f, window, OBJ_STREAM_WINDOW, stream_line, &s) &&
+             (s.n_batch == 0 || flush_batch(&s));
+        if (s.io_error) {
+            fprintf(stderr, "Could not spill attributes of %s to a "
+                    "temporary file\n", file_name);
+        }
+    }
+    for (int k = 0; k < N_ATTRIBS; k++) {
+        attrib_pages_close(&s.attribs[k]);
+    }
+    arena_free(&arena);
+    fclose(f);
+    return ok;
+}
+
+// Parses the MTL statements Material holds into m. Unknown statements
+// are ignored.
+static void parse_mtl_line(const char* p, const char* end, Material* m) {
+    p = skip_space(p, end);
+    const char* cmd = p;
+    p = skip_token(p, end);
+    size_t cmd_len = p - cmd;
+    if (cmd_len == 2 && memcmp(cmd, "Kd", 2) == 0) {
+        parse_floats(p, end, m->diffuse, 3);
+    } else if (cmd_len == 2 && memcmp(cmd, "Ks", 2) == 0) {
+        parse_floats(p, end, m->specular, 3);
+    } else if (cmd_len == 2 && memcmp(cmd, "Ns", 2) == 0) {
+        parse_floats(p, end, &m->shininess, 1);
+    } else if (cmd_len == 6 && memcmp(cmd, "map_Kd", 6) == 0) {
+        // Options such as -s come before the file name, which is last.
+        trim(&p, &end);
+        const char* name = end;
+        while (name > p && !is_space(name[-1])) {
+            name--;
+        }
+        copy_name(m->diffuse_map, name, end - name);
+    }
+}
+
+bool read_mtl_file(Arena* arena, const char* file_name,
+                   Material** materials, size_t* n_materials) {
+    MappedFile file;
+    if (!map_file(&file, file_name)) {
+        fprintf(stderr, "Could not read mtl file %s\n", file_name);
+        return false;
+    }
+    const char* end = file.data + file.len;
+    size_t n = 0;
+    for (const char* c = file.data; c < end;) {
+        const char* eol = find_eol(c, end);
+        const char* p = skip_space(c, eol);
+        n += eol - p >= 6 && memcmp(p, "newmtl", 6) == 0;
+        c = eol + 1;
+    }
+    Material* mats = arena_alloc(arena, (n ? n : 1) * sizeof *mats);
+    if (!mats) {
+        fprintf(stderr, "Out of memory loading %s\n", file_name);
+        unmap_file(&file);
+        return false;
+    }
+    Material* cur = NULL;
+    n = 0;
+    for (const char* c = file.data; c < end;) {
+        const char* eol = find_eol(c, end);
+        const char* p = skip_space(c, eol);
+        const char* tok = skip_token(p, eol);
+        if (tok - p == 6 && memcmp(p, "newmtl", 6) == 0) {
+            cur = &mats[n++];
+            *cur = (Material){.diffuse = {1, 1, 1}, .shininess = 1};
+            const char* name_end = eol;
+            trim(&tok, &name_end);
+            copy_name(cur->name, tok, name_end - tok);
+        } else if (cur) {
+            parse_mtl_line(p, eol, cur);
+        }
+        c = eol + 1;
+    }
+    unmap_file(&file);
+    *materials = mats;
+    *n_materials = n;
+    return true;
+}
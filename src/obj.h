@@ -0,0 +1,79 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include "arena.h"
+#include "mesh.h"
+#include "pool.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Reads an OBJ file into an indexed mesh. Corners with the same
+// position, texture coordinate and normal indices share one vertex; 16-bit
+// indices are used when there are at most 65536 vertices. Corners without
+// a normal get the face normal of their triangle. Polygons with more than
+// three corners are split into a triangle fan. Every `o` and `usemtl` line
+// starts a new submesh, named after the current object and material. The
+// first `mtllib` line is kept in mesh->material_lib.
+//
+// The file is memory-mapped and its text scanned twice, once to count
+// records and once to parse them, so every array is allocated once with
+// its final size. All memory, including the mesh, comes from arena.
+//
+// With a pool, large files are split at line boundaries and the chunks are
+// parsed in parallel: first counts, then attributes, then faces once all
+// attribute offsets are known. The result is the same as without a pool.
+bool read_obj_file(Arena* arena, Pool* pool, const char* file_name,
+                   Mesh* mesh);
+
+typedef struct {
+    // Vertices to come, three per triangle.
+    size_t n_verts;
+    // Bounds of the positions.
+    float min[3], max[3];
+    // As in Mesh.
+    char material_lib[SUBMESH_NAME_SIZE];
+} ObjStreamInfo;
+
+// Receives a streamed OBJ file. Returning false from either function
+// stops the stream.
+typedef struct {
+    // Called once, before any vertices.
+    bool (*begin)(void* user, const ObjStreamInfo* info);
+    // Called with consecutive batches of n vertices in the layout of
+    // Mesh, the first of which is vertex number first.
+    bool (*write)(void* user, size_t first, const float* verts, size_t n);
+    void* user;
+} ObjStreamSink;
+
+// Reads an OBJ file without building the whole mesh in memory, for files
+// too large for read_obj_file. The file is read twice, in windows of 1 MB:
+// once to count records and find the bounds, and once to turn faces into
+// triangles. Only the attributes are kept, and the triangles go to sink in
+// batches. Vertices are not shared between triangles, and there are no
+// submeshes, clusters or levels of detail.
+//
+// The window, a batch and the attributes take at most mem_cap bytes. If
+// the attributes do not fit, they are written to a temporary file in
+// pages and read back as faces need them, which is fast when faces use
+// attributes defined near them. Fails if mem_cap is below about 1.4 MB.
+bool stream_obj_file(const char* file_name, size_t mem_cap,
+                     const ObjStreamSink* sink);
+
+// Material from an MTL file. Only Kd, Ks, Ns and map_Kd are read; missing
+// ones keep the defaults of white diffuse color, black specular color,
+// shininess 1 and no texture. The renderer only draws the diffuse part.
+typedef struct {
+    char name[SUBMESH_NAME_SIZE];
+    // Kd, Ks and Ns.
+    float diffuse[3];
+    float specular[3];
+    float shininess;
+    // Texture file from map_Kd, relative to the MTL file, or empty.
+    char diffuse_map[SUBMESH_NAME_SIZE];
+} Material;
+
+// Reads every `newmtl` block of an MTL file into an array from arena.
+bool read_mtl_file(Arena* arena, const char* file_name,
+                   Material** materials, size_t* n_materials);
+
+#endif // OBJ_H
@@ -0,0 +1,127 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+    JobFn fn;
+    void* arg;
+} Job;
+
+struct Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+    // Ring buffer of queued jobs.
+    Job* jobs;
+    size_t cap, head, n_queued;
+    // Queued plus running jobs.
+    size_t n_pending;
+    bool quit;
+    int n_threads;
+    pthread_t threads[];
+};
+
+static void* worker(void* arg) {
+    Pool* pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->n_queued == 0 && !pool->quit) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (pool->n_queued == 0) {
+            break;
+        }
+        Job job = pool->jobs[pool->head];
+        pool->head = (pool->head + 1) % pool->cap;
+        pool->n_queued--;
+        pthread_mutex_unlock(&pool->lock);
+        job.fn(job.arg);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->n_pending == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+Pool* pool_create(int n_threads) {
+    if (n_threads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n > 0 ? n : 1;
+    }
+    Pool* pool = calloc(1, sizeof *pool + n_threads * sizeof (pthread_t));
+    if (!pool) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    for (int i = 0; i < n_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0) {
+            break;
+        }
+        pool->n_threads++;
+    }
+    if (pool->n_threads == 0) {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void pool_destroy(Pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->jobs);
+    free(pool);
+}
+
+int pool_size(const Pool* pool) {
+    return pool->n_threads;
+}
+
+void pool_submit(Pool* pool, JobFn fn, void* arg) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->n_queued == pool->cap) {
+        size_t cap = pool->cap ? pool->cap * 2 : 64;
+        Job* jobs = malloc(cap * sizeof *jobs);
+        if (!jobs) {
+            // Out of memory: run the job on the caller's thread.
+            pthread_mutex_unlock(&pool->lock);
+            fn(arg);
+            return;
+        }
+        for (size_t i = 0; i < pool->n_queued; i++) {
+            jobs[i] = pool->jobs[(pool->head + i) % pool->cap];
+        }
+        free(pool->jobs);
+        pool->jobs = jobs;
+        pool->cap = cap;
+        pool->head = 0;
+    }
+    pool->jobs[(pool->head + pool->n_queued) % pool->cap] = (Job){fn, arg};
+    pool->n_queued++;
+    pool->n_pending++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(Pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->n_pending > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
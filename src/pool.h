@@ -0,0 +1,18 @@
+#ifndef POOL_H
+#define POOL_H
+
+typedef struct Pool Pool;
+
+typedef void (*JobFn)(void* arg);
+
+// Fixed set of worker threads running jobs in submission order.
+// n_threads <= 0 means one thread per online CPU.
+Pool* pool_create(int n_threads);
+// Waits for all submitted jobs and joins the workers.
+void pool_destroy(Pool* pool);
+int pool_size(const Pool* pool);
+void pool_submit(Pool* pool, JobFn fn, void* arg);
+// Blocks until every job submitted so far has finished.
+void pool_wait(Pool* pool);
+
+#endif // POOL_H
@@ -0,0 +1,570 @@
+#include "simplify.h"
+#include "meshopt.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Each level aims for this fraction of the triangles of the one before, and
+// is dropped if it does not get below MIN_REDUCTION of them.
+#define LOD_REDUCTION 0.5
+#define MIN_REDUCTION 0.9
+
+// A level is finished when a pass removes less than 1/STALL_FRACTION of the
+// remaining triangles.
+#define STALL_FRACTION 100
+
+// Collapses that turn a triangle's normal by more than about 75 degrees are
+// rejected, which also rules out flipping it.
+#define MIN_NORMAL_DOT 0.25
+
+// Symmetric 4x4 matrix, upper triangle row by row.
+typedef struct {
+    double m[10];
+} Quadric;
+
+typedef struct {
+    double cost;
+    uint32_t from, to;
+} Collapse;
+
+typedef struct {
+    const Mesh* mesh;
+    // Vertices with the same position are welded into one point, and the
+    // simplifier works on points.
+    size_t n_points;
+    uint32_t* point_of;
+    uint32_t* first_vert;
+    uint32_t* next_vert;
+    Quadric* quadrics;
+    // Per point: the point it was collapsed onto, or itself.
+    uint32_t* collapsed;
+    // Per point: touched by a collapse in this pass.
+    bool* locked;
+    // Triangles around each point, as offsets into one array.
+    uint32_t* first_tri;
+    uint32_t* point_tris;
+    Collapse* collapses;
+} Simplifier;
+
+static void quadric_add_plane(Quadric* q, const double n[3], double d) {
+    double a = n[0], b = n[1], c = n[2];
+    q->m[0] += a * a;
+    q->m[1] += a * b;
+    q->m[2] += a * c;
+    q->m[3] += a * d;
+    q->m[4] += b * b;
+    q->m[5] += b * c;
+    q->m[6] += b * d;
+    q->m[7] += c * c;
+    q->m[8] += c * d;
+    q->m[9] += d * d;
+}
+
+static void quadric_add(Quadric* q, const Quadric* r) {
+    for (int i = 0; i < 10; i++) {
+        q->m[i] += r->m[i];
+    }
+}
+
+// Sum of squared distances from p to the planes in q.
+static double quadric_error(const Quadric* q, const float* p) {
+    double x = p[0], y = p[1], z = p[2];
+    const double* m = q->m;
+    double e = m[0] * x * x + m[4] * y * y + m[7] * z * z + m[9] +
+               2 * (m[1] * x * y + m[2] * x * z + m[5] * y * z +
+                    m[3] * x + m[6] * y + m[8] * z);
+    return e > 0 ? e : 0;
+}
+
+static const float* point_pos(const Simplifier* s, uint32_t p) {
+    return &s->mesh->verts[s->first_vert[p] * MESH_STRIDE];
+}
+
+// Unnormalized normal of the triangle a, b, c.
+static void tri_normal(const float* a, const float* b, const float* c,
+                       double n[3]) {
+    double e1[3], e2[3];
+    for (int k = 0; k < 3; k++) {
+        e1[k] = b[k] - a[k];
+        e2[k] = c[k] - a[k];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static uint32_t hash_pos(const float* p) {
+    uint32_t bits[3];
+    memcpy(bits, p, sizeof bits);
+    // Round numbers have all-zero low mantissa bits, so mix the high bits
+    // down (MurmurHash3 finalizer).
+    uint32_t h = bits[0] * 73856093u ^ bits[1] * 19349663u ^
+                 bits[2] * 83492791u;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+// Welds the vertices used by tris. point_of must be UINT32_MAX for every
+// vertex beforehand, and is only valid for those vertices afterwards.
+static bool weld_points(Arena* arena, Simplifier* s, const uint32_t* tris,
+                        size_t n_indices) {
+    const Mesh* mesh = s->mesh;
+    size_t cap = 16;
+    while (cap < n_indices * 2) {
+        cap *= 2;
+    }
+    uint32_t* table = arena_alloc(arena, cap * sizeof *table);
+    s->first_vert = arena_alloc(arena, n_indices * sizeof *s->first_vert);
+    if (!table || !s->first_vert) {
+        return false;
+    }
+    memset(table, 0xff, cap * sizeof *table);
+    s->n_points = 0;
+    for (size_t i = 0; i < n_indices; i++) {
+        uint32_t v = tris[i];
+        if (s->point_of[v] != UINT32_MAX) {
+            continue;
+        }
+        const float* pos = &mesh->verts[v * MESH_STRIDE];
+        size_t h = hash_pos(pos) & (cap - 1);
+        for (;;) {
+            uint32_t p = table[h];
+            if (p == UINT32_MAX) {
+                p = s->n_points++;
+                table[h] = p;
+                s->first_vert[p] = v;
+                s->next_vert[v] = UINT32_MAX;
+                s->point_of[v] = p;
+                break;
+            }
+            if (memcmp(point_pos(s, p), pos, 3 * sizeof *pos) == 0) {
+                s->next_vert[v] = s->next_vert[s->first_vert[p]];
+                s->next_vert[s->first_vert[p]] = v;
+                s->point_of[v] = p;
+                break;
+            }
+            h = (h + 1) & (cap - 1);
+        }
+    }
+    return true;
+}
+
+static void build_adjacency(Simplifier* s, const uint32_t* tris,
+                            size_t n_tris) {
+    memset(s->first_tri, 0, (s->n_points + 1) * sizeof *s->first_tri);
+    for (size_t i = 0; i < n_tris * 3; i++) {
+        s->first_tri[s->point_of[tris[i]] + 1]++;
+    }
+    for (size_t p = 0; p < s->n_points; p++) {
+        s->first_tri[p + 1] += s->first_tri[p];
+    }
+    for (size_t i = 0; i < n_tris * 3; i++) {
+        s->point_tris[s->first_tri[s->point_of[tris[i]]]++] = i / 3;
+    }
+    // Filling moved every offset to the start of the next point.
+    for (size_t p = s->n_points; p > 0; p--) {
+        s->first_tri[p] = s->first_tri[p - 1];
+    }
+    s->first_tri[0] = 0;
+}
+
+static bool tri_has_point(const Simplifier* s, const uint32_t* tri,
+                          uint32_t p) {
+    return s->point_of[tri[0]] == p || s->point_of[tri[1]] == p ||
+           s->point_of[tri[2]] == p;
+}
+
+// Quadrics of the planes of all triangles around each point, plus planes
+// perpendicular to the border edges so that open borders keep their shape.
+static void init_quadrics(Simplifier* s, const uint32_t* tris,
+                          size_t n_tris) {
+    memset(s->quadrics, 0, s->n_points * sizeof *s->quadrics);
+    build_adjacency(s, tris, n_tris);
+    for (size_t t = 0; t < n_tris; t++) {
+        const uint32_t* tri = &tris[t * 3];
+        const float* pos[3];
+        for (int k = 0; k < 3; k++) {
+            pos[k] = point_pos(s, s->point_of[tri[k]]);
+        }
+        double n[3];
+        tri_normal(pos[0], pos[1], pos[2], n);
+        double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len == 0) {
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            n[k] /= len;
+        }
+        double d = -(n[0] * pos[0][0] + n[1] * pos[0][1] + n[2] * pos[0][2]);
+        for (int k = 0; k < 3; k++) {
+            quadric_add_plane(&s->quadrics[s->point_of[tri[k]]], n, d);
+        }
+
+        for (int k = 0; k < 3; k++) {
+            uint32_t a = s->point_of[tri[k]];
+            uint32_t b = s->point_of[tri[(k + 1) % 3]];
+            int n_shared = 0;
+            for (uint32_t i = s->first_tri[a]; i < s->first_tri[a + 1]; i++) {
+                n_shared += tri_has_point(s, &tris[s->point_tris[i] * 3], b);
+            }
+            if (n_shared != 1) {
+                continue;
+            }
+            const float* pa = point_pos(s, a);
+            const float* pb = point_pos(s, b);
+            double e[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+            double m[3] = {e[1] * n[2] - e[2] * n[1],
+                           e[2] * n[0] - e[0] * n[2],
+                           e[0] * n[1] - e[1] * n[0]};
+            double m_len = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+            if (m_len == 0) {
+                continue;
+            }
+            for (int j = 0; j < 3; j++) {
+                m[j] /= m_len;
+            }
+            double md = -(m[0] * pa[0] + m[1] * pa[1] + m[2] * pa[2]);
+            quadric_add_plane(&s->quadrics[a], m, md);
+            quadric_add_plane(&s->quadrics[b], m, md);
+        }
+    }
+}
+
+static int compare_collapses(const void* a, const void* b) {
+    const Collapse* ca = a;
+    const Collapse* cb = b;
+    if (ca->cost != cb->cost) {
+        return ca->cost < cb->cost ? -1 : 1;
+    }
+    if (ca->from != cb->from) {
+        return ca->from < cb->from ? -1 : 1;
+    }
+    return ca->to < cb->to ? -1 : ca->to > cb->to;
+}
+
+// Checks that moving point from onto point to keeps every triangle around
+// from that survives facing the same way.
+static bool collapse_keeps_normals(const Simplifier* s, const uint32_t* tris,
+                                   uint32_t from, uint32_t to) {
+    for (uint32_t i = s->first_tri[from]; i < s->first_tri[from + 1]; i++) {
+        const uint32_t* tri = &tris[s->point_tris[i] * 3];
+        if (tri_has_point(s, tri, to)) {
+            continue;
+        }
+        const float* before[3];
+        const float* after[3];
+        for (int k = 0; k < 3; k++) {
+            uint32_t p = s->point_of[tri[k]];
+            before[k] = point_pos(s, p);
+            after[k] = point_pos(s, p == from ? to : p);
+        }
+        double n0[3], n1[3];
+        tri_normal(before[0], before[1], before[2], n0);
+        tri_normal(after[0], after[1], after[2], n1);
+        double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+        double len_sq = (n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2]) *
+                        (n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2]);
+        if (dot <= 0 || dot * dot < MIN_NORMAL_DOT * MIN_NORMAL_DOT * len_sq) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The vertex at point p whose texture coordinate and normal are closest to
+// those of vertex v.
+static uint32_t matching_vertex(const Simplifier* s, uint32_t v, uint32_t p) {
+    const float* attr = &s->mesh->verts[v * MESH_STRIDE + 3];
+    uint32_t best = s->first_vert[p];
+    float best_dist = INFINITY;
+    for (uint32_t u = best; u != UINT32_MAX; u = s->next_vert[u]) {
+        const float* other = &s->mesh->verts[u * MESH_STRIDE + 3];
+        float dist = 0;
+        for (int k = 0; k < MESH_STRIDE - 3; k++) {
+            dist += (attr[k] - other[k]) * (attr[k] - other[k]);
+        }
+        if (dist < best_dist) {
+            best_dist = dist;
+            best = u;
+        }
+    }
+    return best;
+}
+
+// Collapses cheapest edges first until n_tris reaches target, touching
+// each point at most once. Returns the new triangle count; tris is
+// rewritten in place.
+static size_t simplify_pass(Simplifier* s, uint32_t* tris, size_t n_tris,
+                            size_t target, double* max_error) {
+    build_adjacency(s, tris, n_tris);
+    size_t n_collapses = 0;
+    for (size_t i = 0; i < n_tris * 3; i++) {
+        uint32_t a = s->point_of[tris[i]];
+        uint32_t b = s->point_of[tris[i / 3 * 3 + (i + 1) % 3]];
+        if (a == b) {
+            continue;
+        }
+        Quadric q = s->quadrics[a];
+        quadric_add(&q, &s->quadrics[b]);
+        double to_b = quadric_error(&q, point_pos(s, b));
+        double to_a = quadric_error(&q, point_pos(s, a));
+        s->collapses[n_collapses++] = to_b <= to_a
+            ? (Collapse){to_b, a, b}
+            : (Collapse){to_a, b, a};
+    }
+    qsort(s->collapses, n_collapses, sizeof *s->collapses, compare_collapses);
+
+    memset(s->locked, 0, s->n_points * sizeof *s->locked);
+    size_t n_live = n_tris;
+    bool changed = false;
+    for (size_t i = 0; i < n_collapses && n_live > target; i++) {
+        Collapse c = s->collapses[i];
+        if (s->locked[c.from] || s->locked[c.to] ||
+            !collapse_keeps_normals(s, tris, c.from, c.to)) {
+            continue;
+        }
+        // The triangles around from are only valid while none of their
+        // points have moved, so lock them all.
+        for (uint32_t j = s->first_tri[c.from]; j < s->first_tri[c.from + 1];
+             j++) {
+            const uint32_t* tri = &tris[s->point_tris[j] * 3];
+            n_live -= tri_has_point(s, tri, c.to);
+            for (int k = 0; k < 3; k++) {
+                s->locked[s->point_of[tri[k]]] = true;
+            }
+        }
+        s->collapsed[c.from] = c.to;
+        quadric_add(&s->quadrics[c.to], &s->quadrics[c.from]);
+        if (c.cost > *max_error) {
+            *max_error = c.cost;
+        }
+        changed = true;
+    }
+    if (!changed) {
+        return n_tris;
+    }
+
+    size_t n_out = 0;
+    for (size_t t = 0; t < n_tris; t++) {
+        uint32_t tri[3];
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = tris[t * 3 + k];
+            uint32_t p = s->point_of[v];
+            tri[k] = s->collapsed[p] == p
+                ? v : matching_vertex(s, v, s->collapsed[p]);
+        }
+        uint32_t p0 = s->point_of[tri[0]];
+        uint32_t p1 = s->point_of[tri[1]];
+        uint32_t p2 = s->point_of[tri[2]];
+        if (p0 != p1 && p1 != p2 && p2 != p0) {
+            memcpy(&tris[n_out * 3], tri, sizeof tri);
+            n_out++;
+        }
+    }
+    return n_out;
+}
+
+// Levels of detail of one submesh. A submesh that cannot be simplified
+// any further repeats its last level.
+typedef struct {
+    uint32_t* tris[MESH_MAX_LODS];
+    size_t n_tris[MESH_MAX_LODS];
+    float error[MESH_MAX_LODS];
+} Levels;
+
+// Simplifies the triangles of one submesh through every level. Each level
+// continues from the one before, so quadrics and errors accumulate down the
+// chain. Submeshes are simplified separately so that every level keeps
+// them apart and they can be drawn one by one.
+static bool simplify_submesh(Arena* arena, Simplifier* s,
+                             const MeshLod* range, Levels* out) {
+    const Mesh* mesh = s->mesh;
+    size_t n_tris = range->n_indices / 3;
+    uint32_t* tris = arena_alloc(arena, n_tris * 3 * sizeof *tris);
+    out->tris[0] = arena_alloc(arena, n_tris * 3 * sizeof *tris);
+    if (!tris || !out->tris[0]) {
+        return false;
+    }
+    for (size_t i = 0; i < n_tris * 3; i++) {
+        tris[i] = mesh_index(mesh, range->first_index + i);
+    }
+    memcpy(out->tris[0], tris, n_tris * 3 * sizeof *tris);
+    out->n_tris[0] = n_tris;
+    out->error[0] = 0;
+    if (!weld_points(arena, s, tris, n_tris * 3)) {
+        return false;
+    }
+    for (size_t p = 0; p < s->n_points; p++) {
+        s->collapsed[p] = p;
+    }
+    init_quadrics(s, tris, n_tris);
+
+    bool done = n_tris == 0;
+    double max_error = 0;
+    for (int l = 1; l < MESH_MAX_LODS; l++) {
+        size_t prev = out->n_tris[l - 1];
+        size_t target = prev * LOD_REDUCTION;
+        while (!done) {
+            size_t n = simplify_pass(s, tris, n_tris, target, &max_error);
+            // Give up on passes that hardly make progress, which happens
+            // when most collapses would fold the surface.
+            bool stalled = n_tris - n < n_tris / STALL_FRACTION + 1;
+            n_tris = n;
+            if (stalled || n <= target) {
+                break;
+            }
+        }
+        // Parts that would vanish or hardly shrink stay as they are.
+        done = done || n_tris == 0 || n_tris > prev * MIN_REDUCTION;
+        if (done) {
+            out->tris[l] = out->tris[l - 1];
+            out->n_tris[l] = prev;
+            out->error[l] = out->error[l - 1];
+            continue;
+        }
+        out->tris[l] = arena_alloc(arena, n_tris * 3 * sizeof *tris);
+        if (!out->tris[l]) {
+            return false;
+        }
+        memcpy(out->tris[l], tris, n_tris * 3 * sizeof *tris);
+        out->n_tris[l] = n_tris;
+        out->error[l] = sqrt(max_error);
+    }
+
+    // Leave point_of clear for the next submesh.
+    for (uint32_t i = 0; i < range->n_indices; i++) {
+        s->point_of[mesh_index(mesh, range->first_index + i)] = UINT32_MAX;
+    }
+    return true;
+}
+
+// Renumbers the vertices in order of first use, walking the levels from
+// the coarsest, and sets the levels' n_verts.
+static bool order_vertices_by_lod(Arena* arena, Mesh* mesh) {
+    uint32_t* remap = arena_alloc(arena, mesh->n_verts * sizeof *remap);
+    float* verts = arena_alloc(arena,
+                               mesh->n_verts * MESH_STRIDE * sizeof *verts);
+    if (!remap || !verts) {
+        return false;
+    }
+    memset(remap, 0xff, mesh->n_verts * sizeof *remap);
+    uint32_t n_used = 0;
+    for (int l = mesh->n_lods - 1; l >= 0; l--) {
+        MeshLod* lod = &mesh->lods[l];
+        for (uint32_t i = lod->first_index;
+             i < lod->first_index + lod->n_indices; i++) {
+            uint32_t v = mesh_index(mesh, i);
+            if (remap[v] == UINT32_MAX) {
+                remap[v] = n_used;
+                memcpy(&verts[n_used * MESH_STRIDE],
+                       &mesh->verts[v * MESH_STRIDE],
+                       MESH_STRIDE * sizeof *verts);
+                n_used++;
+            }
+            mesh_set_index(mesh, i, remap[v]);
+        }
+        lod->n_verts = n_used;
+    }
+    // The levels cover the whole index buffer, so no vertex is missed
+    // unless no triangle uses it.
+    mesh->verts = verts;
+    mesh->n_verts = n_used;
+    return true;
+}
+
+bool build_lods(Arena* arena, Mesh* mesh) {
+    size_t n_tris = mesh->n_indices / 3;
+    mesh->lods[0] = (MeshLod){0, n_tris * 3, 0, mesh->n_verts};
+    mesh->n_lods = 1;
+    if (n_tris == 0) {
+        return true;
+    }
+
+    // A mesh without submeshes is simplified as one.
+    Submesh whole = {.lods = {mesh->lods[0]}};
+    Submesh* parts = mesh->n_submeshes ? mesh->submeshes : &whole;
+    size_t n_parts = mesh->n_submeshes ? mesh->n_submeshes : 1;
+
+    Simplifier s = {.mesh = mesh};
+    s.point_of = arena_alloc(arena, mesh->n_verts * sizeof *s.point_of);
+    s.next_vert = arena_alloc(arena, mesh->n_verts * sizeof *s.next_vert);
+    s.quadrics = arena_alloc(arena, mesh->n_verts * sizeof *s.quadrics);
+    s.collapsed = arena_alloc(arena, mesh->n_verts * sizeof *s.collapsed);
+    s.locked = arena_alloc(arena, mesh->n_verts * sizeof *s.locked);
+    s.first_tri = arena_alloc(arena,
+                              (mesh->n_verts + 1) * sizeof *s.first_tri);
+    s.point_tris = arena_alloc(arena, n_tris * 3 * sizeof *s.point_tris);
+    s.collapses = arena_alloc(arena, n_tris * 3 * sizeof *s.collapses);
+    Levels* levels = arena_alloc(arena, n_parts * sizeof *levels);
+    if (!s.point_of || !s.next_vert || !s.quadrics || !s.collapsed ||
+        !s.locked || !s.first_tri || !s.point_tris || !s.collapses ||
+        !levels) {
+        return false;
+    }
+    memset(s.point_of, 0xff, mesh->n_verts * sizeof *s.point_of);
+    for (size_t i = 0; i < n_parts; i++) {
+        if (!simplify_submesh(arena, &s, &parts[i].lods[0], &levels[i])) {
+            return false;
+        }
+    }
+
+    // Levels are laid out one after the other, each with the submeshes in
+    // order. A level is only kept if the mesh as a whole got smaller.
+    MeshLod lods[MESH_MAX_LODS] = {mesh->lods[0]};
+    int n_lods = 1;
+    size_t n_indices = n_tris * 3;
+    for (; n_lods < MESH_MAX_LODS; n_lods++) {
+        size_t total = 0;
+        float error = 0;
+        for (size_t i = 0; i < n_parts; i++) {
+            total += levels[i].n_tris[n_lods];
+            error = fmaxf(error, levels[i].error[n_lods]);
+        }
+        if (total > lods[n_lods - 1].n_indices / 3 * MIN_REDUCTION) {
+            break;
+        }
+        lods[n_lods] = (MeshLod){n_indices, total * 3, error, 0};
+        n_indices += total * 3;
+    }
+    if (n_lods == 1) {
+        return true;
+    }
+
+    void* indices = arena_alloc(arena, n_indices * mesh->index_size);
+    if (!indices) {
+        return false;
+    }
+    memcpy(indices, mesh->indices, mesh->n_indices * mesh->index_size);
+    Mesh range = *mesh;
+    range.indices = indices;
+    range.n_indices = n_indices;
+    uint32_t* local = arena_alloc(arena, mesh->n_verts * sizeof *local);
+    if (!local) {
+        return false;
+    }
+    memset(local, 0xff, mesh->n_verts * sizeof *local);
+    for (int l = 1; l < n_lods; l++) {
+        uint32_t first = lods[l].first_index;
+        for (size_t i = 0; i < n_parts; i++) {
+            size_t n = levels[i].n_tris[l] * 3;
+            for (size_t j = 0; j < n; j++) {
+                mesh_set_index(&range, first + j, levels[i].tris[l][j]);
+            }
+            if (!optimize_vertex_cache_range(&range, first, n, local)) {
+                return false;
+            }
+            parts[i].lods[l] = (MeshLod){first, n, levels[i].error[l], 0};
+            first += n;
+        }
+    }
+    mesh->indices = indices;
+    mesh->n_indices = n_indices;
+    memcpy(mesh->lods, lods, sizeof lods);
+    mesh->n_lods = n_lods;
+    return order_vertices_by_lod(arena, mesh);
+}
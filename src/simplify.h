@@ -0,0 +1,27 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "arena.h"
+#include "mesh.h"
+#include <stdbool.h>
+
+// Appends up to MESH_MAX_LODS - 1 simplified versions of the mesh to its
+// index buffer, each with about half the triangles of the one before, and
+// fills in mesh->lods. The simplified levels reuse the existing vertices,
+// so the vertex buffer is shared by all of them. Each submesh is
+// simplified on its own, and every level holds all of them in order with
+// their ranges in the submesh's lods.
+//
+// Simplification collapses edges in order of quadric error (Garland and
+// Heckbert), moving one end onto the other. Vertices that only differ in
+// texture coordinate or normal are treated as one point, and collapses
+// that would flip a triangle are skipped.
+//
+// Finally the vertices are renumbered in order of first use by the
+// coarsest level, then by the next finer one and so on, so that every
+// level only uses a prefix of the vertex buffer, of lods[i].n_verts
+// vertices. A loader can then draw a coarse level before the rest of the
+// vertices are in.
+bool build_lods(Arena* arena, Mesh* mesh);
+
+#endif // SIMPLIFY_H